@@ -3,307 +3,4681 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <cmath>
 #include <chrono>
 #include <ctime>
 #include <algorithm>
 #include <sstream>
 #include <iomanip>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <queue>
+#include <functional>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdio>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
 
-static std::mutex g_collectMutex;
+// Primes of the last print-after run, in increasing order. Workers never
+// touch it directly: each fills its own buffer, and the scheme's driver
+// concatenates or merges those once the workers are joined.
 static std::vector<long> g_collectedPrimes;
+
+// With 'mode=count' no list is built at all: workers keep their own counters
+// and the driver stores the total here.
+static bool g_countOnly = false;
+static long g_primeCount = 0;
 static std::mutex g_printMutex;
 
+// Counts every operator new in the process, so a run can report how many
+// heap allocations it made (Scheme B should make O(1) per number).
+static std::atomic<unsigned long> g_heapAllocations{0};
+
+// Kept out of line: once inlined, GCC pairs the malloc() here with the
+// delete at each call site and warns about a new/free mismatch.
+__attribute__((noinline)) void* operator new(std::size_t size) {
+    g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+// ============================================================================
+// TIMESTAMPS
+//
+// Every printed prime carries a millisecond timestamp. Going through
+// system_clock::now(), localtime() (a global lock in glibc, sometimes a stat
+// of /etc/localtime) and strftime() for each one is far more expensive than
+// finding the prime, so:
+//  - TimestampFormatter caches the "YYYY-mm-dd HH:MM:SS" part for the current
+//    second and only writes the milliseconds for every call;
+//  - with 'tscClock=true' the clock itself is read from the TSC, calibrated
+//    against system_clock at startup (x86 with an invariant TSC only).
+// ============================================================================
+int64_t systemNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+class TscClock {
+public:
+    // Measures the TSC rate against system_clock over ~20 ms. Returns false
+    // (and must not be used) without an invariant TSC.
+    bool calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+            return false;
+        }
+        int64_t ns0 = systemNowNs();
+        uint64_t tsc0 = __rdtsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        int64_t ns1 = systemNowNs();
+        uint64_t tsc1 = __rdtsc();
+        if (tsc1 <= tsc0 || ns1 <= ns0) return false;
+
+        ns0_ = ns1;
+        tsc0_ = tsc1;
+        nsPerTickQ32_ = (static_cast<unsigned __int128>(ns1 - ns0) << 32) / (tsc1 - tsc0);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    int64_t nowNs() const {
+#if defined(__x86_64__) || defined(__i386__)
+        uint64_t ticks = __rdtsc() - tsc0_;
+        return ns0_ + static_cast<int64_t>((static_cast<unsigned __int128>(ticks) * nsPerTickQ32_) >> 32);
+#else
+        return systemNowNs();
+#endif
+    }
+
+private:
+    int64_t ns0_ = 0;
+    uint64_t tsc0_ = 0;
+    uint64_t nsPerTickQ32_ = 0;   // nanoseconds per tick, 32.32 fixed point
+};
+
+static bool g_useTscClock = false;
+static TscClock g_tscClock;
+
+// Current time (system_clock epoch, ns) from the configured clock source.
+int64_t timestampNowNs() {
+    return g_useTscClock ? g_tscClock.nowNs() : systemNowNs();
+}
+
+// Not thread-safe: use one per thread (or per writer).
+class TimestampFormatter {
+public:
+    // Writes "YYYY-mm-dd HH:MM:SS.mmm" (23 chars, no terminator) into out.
+    size_t format(int64_t timestampNs, char* out) {
+        int64_t second = timestampNs / 1000000000;
+        int millis = static_cast<int>((timestampNs / 1000000) % 1000);
+        if (second != cachedSecond_) {
+            std::time_t seconds = static_cast<std::time_t>(second);
+            std::tm tmBuf;
+            localtime_r(&seconds, &tmBuf);
+            std::strftime(secondText_, sizeof(secondText_), "%Y-%m-%d %H:%M:%S", &tmBuf);
+            cachedSecond_ = second;
+        }
+        std::memcpy(out, secondText_, 19);
+        out[19] = '.';
+        out[20] = static_cast<char>('0' + millis / 100);
+        out[21] = static_cast<char>('0' + millis / 10 % 10);
+        out[22] = static_cast<char>('0' + millis % 10);
+        return 23;
+    }
+
+private:
+    int64_t cachedSecond_ = -1;
+    char secondText_[32];
+};
+
 void printCurrentTimestamp() {
-    auto now = std::chrono::system_clock::now();
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-    std::time_t now_c = std::chrono::system_clock::to_time_t(now);
-    std::tm* now_tm = std::localtime(&now_c);
+    thread_local TimestampFormatter formatter;
+    char buffer[32];
+    std::cout.write(buffer, formatter.format(timestampNowNs(), buffer));
+}
+
+enum Scheme {
+    SCHEME_A,   // range partition, trial division per number
+    SCHEME_B,   // divisor splitting per number
+    SCHEME_C,   // divisor splitting per block of numbers
+    SCHEME_S,   // segmented Sieve of Eratosthenes
+    SCHEME_W,   // wheel-30 bit-packed sieve
+    SCHEME_K,   // bucket sieve for large ranges
+    SCHEME_L,   // Lagarias-Miller-Odlyzko prime counting
+    SCHEME_N,   // n-th prime query
+    SCHEME_Q,   // single-number primality query
+    SCHEME_M    // microbenchmarks
+};
+
+struct Config {
+    long threads = 0;
+    long maxNumber = 0;
+
+    // Optional lower end of the searched window [minNumber..maxNumber].
+    long minNumber = 1;
+
+    // Optional: when 'scheme=' is present the interactive menu is skipped.
+    bool schemeSet = false;
+    Scheme scheme = SCHEME_A;
+    bool printImmediately = false;
+    bool countOnly = false;
+
+    // Primality test selection for isPrime() (see Miller-Rabin below).
+    long millerRabinCrossover = 1L << 19;
+    bool forceTrialDivision = false;
+    bool useMontgomery = true;
+    bool useBailliePSW = false;
+
+    // Scheme B: divisors checked between two looks at the early-exit flag.
+    long cancelPollInterval = 128;
+
+    // Scheme W print-after runs reuse and extend this bitmap cache if set.
+    std::string cacheFile;
+
+    // Print-after output: decimal text on stdout, or a binary gap file.
+    bool binaryOutput = false;
+    std::string outputFile = "primes.bin";
+
+    // Timestamps from a TSC calibrated against system_clock.
+    bool tscClock = false;
+
+    // Scheme A: numbers per work-stealing range.
+    long chunkSize = 1024;
+
+    // Scheme A: start each range from the pre-sieved tile.
+    bool presieve = false;
+
+    // Schemes A/B/C: per-thread hardware counters around the workers.
+    bool perfCounters = false;
+
+    // Schemes A/B: per-thread work, wait and start/stop statistics.
+    bool stats = false;
+
+    // Scheme C: candidates handed to the pool per round.
+    long batchSize = 4096;
+
+    // Scheme Q: the number to test; scheme N: n. Asked for when not set.
+    bool numberSet = false;
+    long number = 0;
+};
+
+bool parseScheme(const std::string& value, Scheme &scheme)
+{
+    if (value == "A" || value == "a") { scheme = SCHEME_A; return true; }
+    if (value == "B" || value == "b") { scheme = SCHEME_B; return true; }
+    if (value == "C" || value == "c") { scheme = SCHEME_C; return true; }
+    if (value == "S" || value == "s") { scheme = SCHEME_S; return true; }
+    if (value == "W" || value == "w") { scheme = SCHEME_W; return true; }
+    if (value == "K" || value == "k") { scheme = SCHEME_K; return true; }
+    if (value == "L" || value == "l") { scheme = SCHEME_L; return true; }
+    if (value == "N" || value == "n") { scheme = SCHEME_N; return true; }
+    if (value == "Q" || value == "q") { scheme = SCHEME_Q; return true; }
+    if (value == "M" || value == "m") { scheme = SCHEME_M; return true; }
+    return false;
+}
+
+// Parses a true/false (or 1/0) setting into 'out'; a bad value is reported
+// and returns false.
+bool parseBool(const std::string &key, const std::string &value, bool &out) {
+    if (value == "true" || value == "1") {
+        out = true;
+    } else if (value == "false" || value == "0") {
+        out = false;
+    } else {
+        std::cerr << "Invalid " << key << " in config (expected true or false): " << value << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    char buffer[30];
-    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", now_tm);
-    std::cout << buffer << '.' << std::setfill('0') << std::setw(3) << ms.count();
+enum ConfigLineResult { CONFIG_APPLIED, CONFIG_UNKNOWN_KEY, CONFIG_BAD_VALUE };
+
+// Applies one 'key=value' setting, from config.txt or a command-line flag.
+// A bad value is reported here; the caller decides whether that is fatal.
+ConfigLineResult applyConfigLine(const std::string &line, Config &config)
+{
+    if (line.rfind("threads=", 0) == 0) {
+        std::string value = line.substr(8);
+        try {
+            config.threads = std::stol(value);
+            if (config.threads <= 0) throw std::invalid_argument("Non-positive threads");
+        } catch (...) {
+            std::cerr << "Invalid thread count in config: " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("maxNumber=", 0) == 0) {
+        std::string value = line.substr(10);
+        try {
+            config.maxNumber = std::stol(value);
+            if (config.maxNumber <= 1) throw std::invalid_argument("Invalid max number");
+        } catch (...) {
+            std::cerr << "Invalid max number in config: " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("minNumber=", 0) == 0) {
+        std::string value = line.substr(10);
+        try {
+            config.minNumber = std::stol(value);
+            if (config.minNumber < 1) throw std::invalid_argument("Invalid min number");
+        } catch (...) {
+            std::cerr << "Invalid min number in config: " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("scheme=", 0) == 0) {
+        std::string value = line.substr(7);
+        if (!parseScheme(value, config.scheme)) {
+            std::cerr << "Invalid scheme in config (expected A, B, C, S, W, K, L, N, Q or M): " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+        config.schemeSet = true;
+    } else if (line.rfind("mode=", 0) == 0) {
+        std::string value = line.substr(5);
+        if (value == "immediate") {
+            config.printImmediately = true;
+            config.countOnly = false;
+        } else if (value == "after") {
+            config.printImmediately = false;
+            config.countOnly = false;
+        } else if (value == "count") {
+            config.printImmediately = false;
+            config.countOnly = true;
+        } else {
+            std::cerr << "Invalid mode in config (expected immediate, after or count): " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("millerRabinCrossover=", 0) == 0) {
+        std::string value = line.substr(21);
+        try {
+            config.millerRabinCrossover = std::stol(value);
+            if (config.millerRabinCrossover < 0) throw std::invalid_argument("Negative crossover");
+        } catch (...) {
+            std::cerr << "Invalid Miller-Rabin crossover in config: " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("forceTrialDivision=", 0) == 0) {
+        if (!parseBool("forceTrialDivision", line.substr(19), config.forceTrialDivision)) return CONFIG_BAD_VALUE;
+    } else if (line.rfind("mulMod=", 0) == 0) {
+        std::string value = line.substr(7);
+        if (value == "montgomery") {
+            config.useMontgomery = true;
+        } else if (value == "int128") {
+            config.useMontgomery = false;
+        } else {
+            std::cerr << "Invalid mulMod in config (expected montgomery or int128): " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("primalityTest=", 0) == 0) {
+        std::string value = line.substr(14);
+        if (value == "millerRabin") {
+            config.useBailliePSW = false;
+        } else if (value == "bpsw") {
+            config.useBailliePSW = true;
+        } else {
+            std::cerr << "Invalid primalityTest in config (expected millerRabin or bpsw): " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("cacheFile=", 0) == 0) {
+        config.cacheFile = line.substr(10);
+    } else if (line.rfind("output=", 0) == 0) {
+        std::string value = line.substr(7);
+        if (value == "text") {
+            config.binaryOutput = false;
+        } else if (value == "binary") {
+            config.binaryOutput = true;
+        } else {
+            std::cerr << "Invalid output in config (expected text or binary): " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("outputFile=", 0) == 0) {
+        config.outputFile = line.substr(11);
+        if (config.outputFile.empty()) {
+            std::cerr << "Empty outputFile in config." << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("tscClock=", 0) == 0) {
+        if (!parseBool("tscClock", line.substr(9), config.tscClock)) return CONFIG_BAD_VALUE;
+    } else if (line.rfind("presieve=", 0) == 0) {
+        if (!parseBool("presieve", line.substr(9), config.presieve)) return CONFIG_BAD_VALUE;
+    } else if (line.rfind("perfCounters=", 0) == 0) {
+        if (!parseBool("perfCounters", line.substr(13), config.perfCounters)) return CONFIG_BAD_VALUE;
+    } else if (line.rfind("stats=", 0) == 0) {
+        if (!parseBool("stats", line.substr(6), config.stats)) return CONFIG_BAD_VALUE;
+    } else if (line.rfind("chunkSize=", 0) == 0) {
+        std::string value = line.substr(10);
+        try {
+            config.chunkSize = std::stol(value);
+            if (config.chunkSize <= 0) throw std::invalid_argument("Non-positive chunk size");
+        } catch (...) {
+            std::cerr << "Invalid chunk size in config: " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("batchSize=", 0) == 0) {
+        std::string value = line.substr(10);
+        try {
+            config.batchSize = std::stol(value);
+            if (config.batchSize <= 0) throw std::invalid_argument("Non-positive batch size");
+        } catch (...) {
+            std::cerr << "Invalid batch size in config: " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("pollInterval=", 0) == 0) {
+        std::string value = line.substr(13);
+        try {
+            config.cancelPollInterval = std::stol(value);
+            if (config.cancelPollInterval <= 0) throw std::invalid_argument("Non-positive poll interval");
+        } catch (...) {
+            std::cerr << "Invalid poll interval in config: " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else if (line.rfind("number=", 0) == 0) {
+        std::string value = line.substr(7);
+        try {
+            config.number = std::stol(value);
+            config.numberSet = true;
+        } catch (...) {
+            std::cerr << "Invalid number in config: " << value << std::endl;
+            return CONFIG_BAD_VALUE;
+        }
+    } else {
+        return CONFIG_UNKNOWN_KEY;
+    }
+    return CONFIG_APPLIED;
 }
 
-void readConfig(const std::string& filename, long &threads, long &maxNumber)
+// Reads 'filename' into config. A missing file is only an error when
+// 'required' (an explicit --config); unknown lines are ignored and a bad
+// value exits.
+void readConfig(const std::string& filename, Config &config, bool required)
 {
     std::ifstream inFile(filename);
     if (!inFile.is_open()) {
+        if (!required) return;
         std::cerr << "Could not open config file: " << filename << std::endl;
         std::exit(1);
     }
 
     std::string line;
-    bool threadsSet = false, maxNumberSet = false;
-
     while (std::getline(inFile, line)) {
-        if (line.rfind("threads=", 0) == 0) {
-            std::string value = line.substr(8);
-            try {
-                threads = std::stol(value);
-                if (threads <= 0) throw std::invalid_argument("Non-positive threads");
-                threadsSet = true;
-            } catch (...) {
-                std::cerr << "Invalid thread count in config: " << value << std::endl;
-                std::exit(1);
-            }
-        } else if (line.rfind("maxNumber=", 0) == 0) {
-            std::string value = line.substr(10);
-            try {
-                maxNumber = std::stol(value);
-                if (maxNumber <= 1) throw std::invalid_argument("Invalid max number");
-                maxNumberSet = true;
-            } catch (...) {
-                std::cerr << "Invalid max number in config: " << value << std::endl;
-                std::exit(1);
-            }
+        if (applyConfigLine(line, config) == CONFIG_BAD_VALUE) {
+            std::cerr << "  in " << filename << std::endl;
+            std::exit(1);
         }
     }
 
     inFile.close();
+}
 
-    if (!threadsSet || !maxNumberSet) {
-        std::cerr << "Config file is missing 'threads=' or 'maxNumber=' entries." << std::endl;
-        std::exit(1);
+// Checks that the settings describe a runnable range; reports and returns
+// false if not.
+bool validateConfig(const Config &config)
+{
+    if (config.threads <= 0 || config.maxNumber <= 1) {
+        std::cerr << "Missing 'threads=' or 'maxNumber=' (set them in the config file or with --threads and --max)." << std::endl;
+        return false;
     }
+    if (config.minNumber > config.maxNumber) {
+        std::cerr << "minNumber (" << config.minNumber << ") is larger than maxNumber ("
+                  << config.maxNumber << ")." << std::endl;
+        return false;
+    }
+    return true;
 }
 
 // ============================================================================
-// SCHEME A: Range Partition
-//
-// We split [1..maxNumber] into 'numThreads' contiguous chunks.
+// RUN STATISTICS ('stats=true')
 //
-// Two printing modes:
-//   A1: Print primes immediately from each thread.
-//   A2: Collect primes in a global vector and print them all at the end.
+// The old g_printMutex / g_collectMutex hot spots are gone: printing threads
+// own a ring buffer each and print-after runs fill per-thread buffers. What a
+// thread can still wait on is a full ring (the writer falling behind), the
+// work-stealing interval locks (Scheme A) and the pool hand-off (Scheme B), so
+// those are what is timed, next to the work done and how long each thread
+// took to start after being spawned and to be joined after it finished.
 // ============================================================================
-bool isPrimeSingleThread(long n) {
-    if (n < 2) return false;
-    if (n == 2) return true;
-    if (n % 2 == 0) return false;
+struct ThreadStats {
+    long tested = 0;
+    long primes = 0;
+    double computeMs = 0;
+    double scheduleWaitMs = 0;   // Scheme A: interval locks; Scheme B: pool hand-off
+    double outputWaitMs = 0;     // blocked on a full print ring
+    double startLatencyMs = 0;   // spawn -> first instruction of the thread
+    double stopLatencyMs = 0;    // last instruction -> join returned
+    std::chrono::steady_clock::time_point spawnedAt, exitedAt;
+    bool driver = false;         // Scheme B's calling thread, not a worker
+};
 
-    long limit = static_cast<long>(std::sqrt(static_cast<long double>(n)));
-    for (long d = 3; d <= limit; d += 2) {
-        if (n % d == 0) {
-            return false;
-        }
-    }
-    return true;
+static bool g_stats = false;
+
+// One slot per worker of the last run (plus one for Scheme B's driver
+// thread); empty when the scheme does not collect statistics.
+static std::vector<ThreadStats> g_threadStats;
+
+// The calling thread's slot, for the waits that happen deep in helpers.
+static thread_local ThreadStats* t_threadStats = nullptr;
+
+double millisBetween(std::chrono::steady_clock::time_point from,
+                     std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
 }
 
-void workerRangeSchemeA(long threadId, long startNum, long endNum, bool printImmediately) {
-    std::thread::id actualThreadId = std::this_thread::get_id();
+// Points the calling thread at its slot and records its start latency.
+// Returns nullptr when statistics are off.
+ThreadStats* attachThreadStats(long slot) {
+    if (!g_stats || slot >= static_cast<long>(g_threadStats.size())) return nullptr;
+    ThreadStats* stats = &g_threadStats[slot];
+    stats->startLatencyMs = millisBetween(stats->spawnedAt, std::chrono::steady_clock::now());
+    t_threadStats = stats;
+    return stats;
+}
 
-    for (long n = startNum; n <= endNum; ++n) {
-        if (isPrimeSingleThread(n)) {
-            if (printImmediately) {
-                std::lock_guard<std::mutex> lk(g_printMutex);
-                std::cout << "[Thread " << threadId << " (Thread ID: " << actualThreadId << ")] Found prime: " 
-                          << n << " (Timestamp: ";
-                printCurrentTimestamp();
-                std::cout << ")\n";
-            } else {
-                std::lock_guard<std::mutex> lk(g_collectMutex);
-                g_collectedPrimes.push_back(n);
-            }
-        }
-    }
+void detachThreadStats(ThreadStats* stats) {
+    if (!stats) return;
+    stats->exitedAt = std::chrono::steady_clock::now();
+    t_threadStats = nullptr;
 }
 
 // ============================================================================
-// SCHEME B: Divisor Splitting
+// IMMEDIATE-PRINT PIPELINE (A1 / B1 and friends)
 //
-// For each number n in [2..maxNumber]:
-//   - Spawn at most 'numThreads' threads (from the config).
-//   - Only check divisors in [2..floor(sqrt(n))].
-//   - Partition that set of divisors among the threads, so each thread
-//     checks a subrange. If any thread finds a divisor, n is not prime.
+// Printing straight to std::cout under g_printMutex caps a run at a few
+// hundred thousand primes per second. Instead every printing thread gets its
+// own single-producer/single-consumer ring of (prime, timestamp) records, and
+// one writer thread drains the rings, formats the lines into a large buffer
+// and hands each full block to the kernel with a single write(2).
 //
-// The prime numbers are then either printed immediately or after.
+// Lines keep the original format, thread ids included; the timestamp is
+// taken when the prime is found, not when it is written.
 // ============================================================================
-void workerCheckDivRange(long n, long startDiv, long endDiv,
-                         bool &compositeFound,
-                         std::mutex &flagMutex) {
-    for (long d = startDiv; d <= endDiv; ++d) {
-        // Early exit if already found a divisor
-        {
-            std::lock_guard<std::mutex> guard(flagMutex);
-            if (compositeFound) return;
+struct PrimeRecord {
+    long n;
+    int64_t timestampNs;   // system_clock, since the epoch
+};
+
+class PrintChannel {
+public:
+    explicit PrintChannel(const std::string &prefix)
+        : prefix_(prefix), slots_(kCapacity) {}
+
+    const std::string &prefix() const { return prefix_; }
+
+    // Producer side. Waits (yielding) while the ring is full.
+    void push(const PrimeRecord &record) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+            auto waitStart = std::chrono::steady_clock::now();
+            while (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+                std::this_thread::yield();
+            }
+            if (t_threadStats) {
+                t_threadStats->outputWaitMs += millisBetween(waitStart, std::chrono::steady_clock::now());
+            }
         }
-        if (n % d == 0) {
-            std::lock_guard<std::mutex> guard(flagMutex);
-            compositeFound = true;
-            return;
+        slots_[tail & (kCapacity - 1)] = record;
+        tail_.store(tail + 1, std::memory_order_release);
+    }
+
+    // Consumer side. Calls fn on every pending record; returns how many.
+    template <typename Fn>
+    size_t drain(Fn fn) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        for (size_t i = head; i != tail; ++i) {
+            fn(slots_[i & (kCapacity - 1)]);
         }
+        head_.store(tail, std::memory_order_release);
+        return tail - head;
     }
-}
 
-bool isPrimeByDivisorThreads(long n, long numThreads) {
-    if (n < 2)  return false;
-    if (n == 2) return true;
-    if (n % 2 == 0) return false;
+private:
+    static const size_t kCapacity = 4096;   // power of two
 
-    long limit = static_cast<long>(std::sqrt(static_cast<long double>(n)));
-    if (limit <= 2) {
-        return true;
+    std::string prefix_;
+    std::vector<PrimeRecord> slots_;
+
+    // Producer and consumer indices on separate cache lines.
+    char pad0_[64];
+    std::atomic<size_t> head_{0};
+    char pad1_[64];
+    std::atomic<size_t> tail_{0};
+    char pad2_[64];
+};
+
+class PrimeWriter {
+public:
+    explicit PrimeWriter(int fd)
+        : fd_(fd), thread_(&PrimeWriter::run, this) {}
+
+    ~PrimeWriter() { stop(); }
+
+    // Called once per printing thread; the channel lives as long as the writer.
+    PrintChannel* openChannel(const std::string &prefix) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        channels_.emplace_back(new PrintChannel(prefix));
+        return channels_.back().get();
     }
 
-    bool compositeFound = false;
-    std::mutex flagMutex;
+    // Call once every producer is done: drains all channels, then joins.
+    void stop() {
+        if (!thread_.joinable()) return;
+        stopping_.store(true, std::memory_order_release);
+        thread_.join();
+    }
 
-    std::vector<long> divisors;
-    for (long d = 3; d <= limit; d += 2) {
-        divisors.push_back(d);
+private:
+    static const size_t kBlockSize = 1 << 20;
+
+    void run() {
+        std::string block;
+        block.reserve(kBlockSize + 4096);
+        std::vector<PrintChannel*> snapshot;
+
+        for (;;) {
+            bool finishing = stopping_.load(std::memory_order_acquire);
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                snapshot.clear();
+                for (auto &ch : channels_) snapshot.push_back(ch.get());
+            }
+
+            size_t drained = 0;
+            for (PrintChannel* ch : snapshot) {
+                drained += ch->drain([&](const PrimeRecord &r) {
+                    appendLine(block, ch->prefix(), r);
+                    if (block.size() >= kBlockSize) flush(block);
+                });
+            }
+
+            if (drained == 0) {
+                flush(block);
+                if (finishing) return;   // producers were done before this pass
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
     }
 
-    if (divisors.empty()) {
-        return true;
+    void appendLine(std::string &block, const std::string &prefix, const PrimeRecord &r) {
+        char digits[24];
+        int len = 0;
+        unsigned long v = static_cast<unsigned long>(r.n);
+        do {
+            digits[len++] = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v);
+        std::reverse(digits, digits + len);
+
+        char stamp[32];
+        size_t stampLen = formatter_.format(r.timestampNs, stamp);
+
+        block.append(prefix);
+        block.append(digits, len);
+        block.append(" (Timestamp: ");
+        block.append(stamp, stampLen);
+        block.append(")\n");
     }
 
-    long totalDivs = static_cast<long>(divisors.size());
-    long chunkSize = totalDivs / numThreads;
-    if (chunkSize == 0) {
-        chunkSize = totalDivs; 
-        numThreads = 1;
+    void flush(std::string &block) {
+        const char* data = block.data();
+        size_t left = block.size();
+        while (left > 0) {
+            ssize_t written = ::write(fd_, data, left);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                break;   // nowhere to report it; drop the block
+            }
+            data += written;
+            left -= static_cast<size_t>(written);
+        }
+        block.clear();
     }
 
-    std::vector<std::thread> threads;
-    threads.reserve(numThreads);
+    const int fd_;
+    TimestampFormatter formatter_;   // writer thread only
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<PrintChannel>> channels_;
+    std::atomic<bool> stopping_{false};
+    std::thread thread_;   // last: starts running once everything above exists
+};
 
-    long startIndex = 0;
-    for (long t = 0; t < numThreads; ++t) {
-        long endIndex = (t == numThreads - 1)
-                       ? (totalDivs - 1)
-                       : (startIndex + chunkSize - 1);
+// The writer of the current run, if it prints immediately. Threads cache
+// their channel together with the epoch of the writer it belongs to.
+static PrimeWriter* g_primeWriter = nullptr;
+static unsigned g_primeWriterEpoch = 0;
+
+void startPrimeWriter() {
+    std::cout.flush();   // everything printed so far goes out first
+    ++g_primeWriterEpoch;
+    g_primeWriter = new PrimeWriter(STDOUT_FILENO);
+}
 
-        if (startIndex > totalDivs - 1) break;
+void stopPrimeWriter() {
+    if (!g_primeWriter) return;
+    g_primeWriter->stop();
+    delete g_primeWriter;
+    g_primeWriter = nullptr;
+}
 
-        long startDiv = divisors[startIndex];
-        long endDiv   = divisors[endIndex];
+// Per-thread, per-format cache of the channel opened in the current writer.
+struct ChannelCache {
+    PrintChannel* channel = nullptr;
+    unsigned epoch = 0;
+};
 
-        threads.emplace_back(workerCheckDivRange,
-                             n,
-                             startDiv,
-                             endDiv,
-                             std::ref(compositeFound),
-                             std::ref(flagMutex));
+template <typename MakePrefix>
+void pushPrime(ChannelCache &cache, long n, MakePrefix makePrefix) {
+    if (cache.epoch != g_primeWriterEpoch) {
+        cache.channel = g_primeWriter->openChannel(makePrefix());
+        cache.epoch = g_primeWriterEpoch;
+    }
+    cache.channel->push({ n, timestampNowNs() });
+}
 
-        startIndex = endIndex + 1;
+void printPrimeLine(long threadId, std::thread::id actualThreadId, long n) {
+    if (g_primeWriter) {
+        thread_local ChannelCache cache;
+        pushPrime(cache, n, [&] {
+            std::ostringstream prefix;
+            prefix << "[Thread " << threadId << " (Thread ID: " << actualThreadId << ")] Found prime: ";
+            return prefix.str();
+        });
+        return;
     }
 
-    for (auto &th : threads) {
-        th.join();
+    std::lock_guard<std::mutex> lk(g_printMutex);
+    std::cout << "[Thread " << threadId << " (Thread ID: " << actualThreadId << ")] Found prime: " 
+              << n << " (Timestamp: ";
+    printCurrentTimestamp();
+    std::cout << ")\n";
+}
+
+long integerSqrt(long n) {
+    long r = static_cast<long>(std::sqrt(static_cast<long double>(n)));
+    while (r > 0 && r > n / r) --r;           // divisions: r * r overflows near 2^63
+    while (r + 1 <= n / (r + 1)) ++r;
+    return r;
+}
+
+// Little-endian integer encoding for the on-disk formats.
+void putU32LE(unsigned char* out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+void putU64LE(unsigned char* out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+uint64_t getU64LE(const unsigned char* in) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(in[i]) << (8 * i);
+    return v;
+}
+
+// Scheme B (and C) find primes on the calling thread, which has no index.
+void printPrimeLineB(long n) {
+    if (g_primeWriter) {
+        thread_local ChannelCache cache;
+        pushPrime(cache, n, [] {
+            std::ostringstream prefix;
+            prefix << "[Thread ID: " << std::this_thread::get_id() << "] Found prime: ";
+            return prefix.str();
+        });
+        return;
     }
 
-    return !compositeFound;
+    std::lock_guard<std::mutex> lk(g_printMutex);
+    std::cout << "[Thread ID: " << std::this_thread::get_id() << "] Found prime: " 
+              << n << " (Timestamp: ";
+    printCurrentTimestamp();
+    std::cout << ")\n";
 }
 
-void runSchemeB(long maxNumber, long numThreads, bool printImmediately) {
-    for (long n = 2; n <= maxNumber; ++n) {
-        bool prime = isPrimeByDivisorThreads(n, numThreads);
-        if (prime) {
-            if (printImmediately) {
-                std::lock_guard<std::mutex> lk(g_printMutex);
-                std::cout << "[Thread ID: " << std::this_thread::get_id() << "] Found prime: " 
-                          << n << " (Timestamp: ";
-                printCurrentTimestamp();
-                std::cout << ")\n";
-            } else {
-                std::lock_guard<std::mutex> lk(g_collectMutex);
-                g_collectedPrimes.push_back(n);
+// ============================================================================
+// HARDWARE PERFORMANCE COUNTERS ('perfCounters=true')
+//
+// Each instrumented worker opens its own perf_event_open counters (pid 0,
+// any CPU, so they follow the thread) when it starts and reads them when it
+// stops: cycles, instructions, branch misses, cache misses and context
+// switches. That tells division latency (low IPC), unpredictable branches
+// and lock or scheduler trouble (context switches) apart.
+//
+// Counters the kernel refuses (no PMU in a VM, perf_event_paranoid, no Linux)
+// simply stay closed and print as '-'; the run itself is unaffected.
+// ============================================================================
+enum PerfEvent { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES, PERF_CACHE_MISSES,
+                 PERF_CONTEXT_SWITCHES, kPerfEvents };
+
+static const char* const kPerfEventNames[kPerfEvents] = {
+    "cycles", "instructions", "branch-miss", "cache-miss", "ctx-switch"
+};
+
+struct PerfSample {
+    bool valid = false;          // the thread was instrumented
+    bool have[kPerfEvents] = {};
+    uint64_t values[kPerfEvents] = {};
+};
+
+static bool g_perfCounters = false;
+
+// One slot per worker of the last run, written by that worker only.
+static std::vector<PerfSample> g_threadPerf;
+
+class PerfCounters {
+public:
+    // Opens and starts the counters for the calling thread.
+    PerfCounters() {
+        for (int e = 0; e < kPerfEvents; ++e) {
+            fds_[e] = open(static_cast<PerfEvent>(e));
+            if (fds_[e] >= 0) {
+#ifdef __linux__
+                ::ioctl(fds_[e], PERF_EVENT_IOC_RESET, 0);
+                ::ioctl(fds_[e], PERF_EVENT_IOC_ENABLE, 0);
+#endif
             }
         }
     }
-}
 
-int main() {
-    // 1) Read config
-    long numThreads = 0;
-    long maxNumber = 0;
-    readConfig("config.txt", numThreads, maxNumber);
-    std::cout << "Config says: threads=" << numThreads
-              << ", maxNumber=" << maxNumber << "\n\n";
-
-    // 2) Let user pick which scheme (A or B) and print mode
-    int choice;
-    do {
-        std::cout << "Choose approach:\n"
-                  << "  1) Scheme A (range partition) + immediate printing\n"
-                  << "  2) Scheme A (range partition) + print after\n"
-                  << "  3) Scheme B (divisor-splitting, up to sqrt) + immediate printing\n"
-                  << "  4) Scheme B (divisor-splitting, up to sqrt) + print after\n"
-                  << "Enter choice (1-4): ";
-        std::cin >> choice;
-
-        if (std::cin.fail() || choice < 1 || choice > 4) {
-            std::cin.clear();
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            std::cerr << "Invalid choice. Please enter a number between 1 and 4.\n";
-        }
-    } while (choice < 1 || choice > 4);
-
-    bool printImmediately = (choice == 1 || choice == 3);
+    ~PerfCounters() {
+        for (int fd : fds_) {
+            if (fd >= 0) ::close(fd);
+        }
+    }
 
-    auto startTime = std::chrono::steady_clock::now();
-    std::time_t startWallClock = std::time(nullptr);
-    std::cout << "\n=== Run started at ";
-    printCurrentTimestamp();
-    std::cout << "\n";
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
 
-    g_collectedPrimes.clear();
+    // Counts so far, scaled up if the kernel had to multiplex the counters.
+    PerfSample read() const {
+        PerfSample sample;
+        sample.valid = true;
+        for (int e = 0; e < kPerfEvents; ++e) {
+            uint64_t buf[3];   // value, time enabled, time running
+            if (fds_[e] < 0 || ::read(fds_[e], buf, sizeof(buf)) != sizeof(buf)) continue;
+            sample.have[e] = true;
+            sample.values[e] = buf[2] == 0 ? 0
+                : static_cast<uint64_t>(static_cast<long double>(buf[0]) * buf[1] / buf[2]);
+        }
+        return sample;
+    }
 
-    // 4) Launch Scheme A or B
-    std::vector<std::thread> threadsA;
-    threadsA.reserve(numThreads);
+private:
+    // Kernel-side counting is tried first (context switches happen there);
+    // with a strict perf_event_paranoid we fall back to user space only.
+    static int open(PerfEvent event) {
+#ifdef __linux__
+        static const struct { uint32_t type; uint64_t config; } kEvents[kPerfEvents] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+        };
+        for (int excludeKernel = 0; excludeKernel <= 1; ++excludeKernel) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = kEvents[event].type;
+            attr.config = kEvents[event].config;
+            attr.disabled = 1;
+            attr.exclude_kernel = excludeKernel;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+            if (fd >= 0) return fd;
+        }
+#else
+        (void)event;
+#endif
+        return -1;
+    }
 
-    if (choice == 1 || choice == 2) {
-        // Scheme A
-        long rangeSize = maxNumber / numThreads;
-        long start = 1;
-        for (long i = 0; i < numThreads; ++i) {
-            long end = (i == numThreads - 1)
-                      ? maxNumber
-                      : (start + rangeSize - 1);
-
-            threadsA.emplace_back(workerRangeSchemeA,
-                                  i,
-                                  start,
-                                  end,
-                                  printImmediately);
-            start = end + 1;
-        }
-    } else if (choice == 3 || choice == 4) {
-        // Scheme B
-        runSchemeB(maxNumber, numThreads, printImmediately);
-    } else {
-        std::cerr << "Invalid choice.\n";
-        return 1;
+    int fds_[kPerfEvents];
+};
+
+// Owned by an instrumented worker: counts from construction to destruction
+// and then stores the sample in g_threadPerf[slot]. Does nothing unless
+// 'perfCounters=true' and the run reserved a slot for this worker.
+class PerfScope {
+public:
+    explicit PerfScope(long slot)
+        : slot_(slot),
+          counters_(g_perfCounters && slot < static_cast<long>(g_threadPerf.size())
+                    ? new PerfCounters() : nullptr) {}
+
+    ~PerfScope() {
+        if (counters_) g_threadPerf[slot_] = counters_->read();
     }
 
-    // 5) Join threads
-    for (auto &t : threadsA) {
-        t.join();
+private:
+    long slot_;
+    std::unique_ptr<PerfCounters> counters_;
+};
+
+void printPerfCounters() {
+    PerfSample total;
+    bool any = false;
+    for (const PerfSample &s : g_threadPerf) {
+        if (!s.valid) continue;
+        total.valid = true;
+        for (int e = 0; e < kPerfEvents; ++e) {
+            if (!s.have[e]) continue;
+            any = true;
+            total.have[e] = true;
+            total.values[e] += s.values[e];
+        }
+    }
+    if (!total.valid) return;   // this scheme's workers are not instrumented
+    if (!any) {
+        std::cout << "Performance counters unavailable (perf_event_open refused; "
+                     "see /proc/sys/kernel/perf_event_paranoid).\n";
+        return;
     }
 
-    // 6) If printing is to be done after
-    if (!printImmediately) {
-        std::sort(g_collectedPrimes.begin(), g_collectedPrimes.end());
-        std::cout << "\n=== Primes found:\n";
-        for (long p : g_collectedPrimes) {
-            std::cout << p << " ";
+    auto printRow = [](const std::string &label, const PerfSample &s) {
+        std::cout << std::setw(8) << label;
+        for (int e = 0; e < kPerfEvents; ++e) {
+            if (s.have[e]) std::cout << std::setw(15) << s.values[e];
+            else           std::cout << std::setw(15) << "-";
+        }
+        if (s.have[PERF_CYCLES] && s.have[PERF_INSTRUCTIONS] && s.values[PERF_CYCLES] > 0) {
+            std::cout << std::setw(8) << std::fixed << std::setprecision(2)
+                      << static_cast<double>(s.values[PERF_INSTRUCTIONS]) / s.values[PERF_CYCLES];
+            std::cout.unsetf(std::ios::floatfield);
+        } else {
+            std::cout << std::setw(8) << "-";
+        }
+        std::cout << "\n";
+    };
+
+    std::cout << "Per-thread performance counters:\n" << std::setfill(' ') << std::setw(8) << "thread";
+    for (int e = 0; e < kPerfEvents; ++e) {
+        std::cout << std::setw(15) << kPerfEventNames[e];
+    }
+    std::cout << std::setw(8) << "IPC" << "\n";
+    for (size_t i = 0; i < g_threadPerf.size(); ++i) {
+        if (g_threadPerf[i].valid) printRow(std::to_string(i), g_threadPerf[i]);
+    }
+    printRow("total", total);
+    std::cout << std::setprecision(6);
+}
+
+// ============================================================================
+// SCHEME A: Range Partition
+//
+// We split [minNumber..maxNumber] into small ranges that 'numThreads' threads take
+// from a work-stealing scheduler (see below).
+//
+// Two printing modes:
+//   A1: Print primes immediately from each thread.
+//   A2: Collect primes in per-range buffers and print them all at the end.
+// With 'mode=count' the threads only count.
+// ============================================================================
+bool isPrimeSingleThread(long n) {
+    if (n < 2) return false;
+    if (n == 2) return true;
+    if (n % 2 == 0) return false;
+
+    long limit = static_cast<long>(std::sqrt(static_cast<long double>(n)));
+    for (long d = 3; d <= limit; d += 2) {
+        if (n % d == 0) {
+            return false;
         }
-        std::cout << std::endl;
     }
+    return true;
+}
 
-    // 7) Print end time and total elapsed
-    auto endTime = std::chrono::steady_clock::now();
-    std::time_t endWallClock = std::time(nullptr);
-    std::cout << "\n=== Run ended at ";
-    printCurrentTimestamp();
-    std::cout << "\n";
+// ----------------------------------------------------------------------------
+// Deterministic Miller-Rabin for 64-bit inputs.
+//
+// Trial division costs O(sqrt(n)) divisions, which is hopeless near 2^63.
+// Above 'g_millerRabinCrossover' isPrime() switches to Miller-Rabin with the
+// 7 bases found by Jim Sinclair, which is deterministic for every n < 2^64.
+// 'g_forceTrialDivision' turns the switch off, to cross-check results.
+// ----------------------------------------------------------------------------
+static long g_millerRabinCrossover = 1L << 19;
+static bool g_forceTrialDivision = false;
+static bool g_useMontgomery = true;
 
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
-    std::cout << "Total elapsed time: " << elapsed << " ms\n\n";
+uint64_t mulMod64(uint64_t a, uint64_t b, uint64_t m) {
+    return static_cast<uint64_t>(static_cast<unsigned __int128>(a) * b % m);
+}
 
-    return 0;
+uint64_t powMod64(uint64_t base, uint64_t exp, uint64_t m) {
+    uint64_t result = 1;
+    base %= m;
+    while (exp) {
+        if (exp & 1) result = mulMod64(result, base, m);
+        base = mulMod64(base, base, m);
+        exp >>= 1;
+    }
+    return result;
+}
+
+bool isPrimeMillerRabin(long n) {
+    if (n < 2) return false;
+
+    static const long smallPrimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+    for (long p : smallPrimes) {
+        if (n % p == 0) return n == p;
+    }
+
+    const uint64_t m = static_cast<uint64_t>(n);
+    uint64_t d = m - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+
+    static const uint64_t bases[] = { 2, 325, 9375, 28178, 450775, 9780504, 1795265022 };
+    for (uint64_t a : bases) {
+        a %= m;
+        if (a == 0) continue;
+
+        uint64_t x = powMod64(a, d, m);
+        if (x == 1 || x == m - 1) continue;
+
+        bool witness = true;
+        for (int r = 1; r < s && witness; ++r) {
+            x = mulMod64(x, x, m);
+            if (x == m - 1) witness = false;
+        }
+        if (witness) return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Montgomery arithmetic.
+//
+// mulMod64 above pays for a 128-by-64-bit division on every multiply. In
+// Montgomery form (x * 2^64 mod n) a product is reduced with two 64x64->128
+// multiplies and a subtraction instead, using n^-1 mod 2^64 precomputed once
+// per modulus. Only valid for odd n.
+// ----------------------------------------------------------------------------
+struct Montgomery64 {
+    uint64_t n;
+    uint64_t nInv;   // n * nInv == 1 (mod 2^64)
+    uint64_t r2;     // 2^128 mod n, converts into Montgomery form
+    uint64_t one;    // 2^64 mod n, i.e. 1 in Montgomery form
+
+    explicit Montgomery64(uint64_t modulus) : n(modulus) {
+        nInv = n;                          // correct to 3 bits for odd n
+        for (int i = 0; i < 5; ++i) {      // Newton: 3 -> 6 -> ... -> 96 bits
+            nInv *= 2 - n * nInv;
+        }
+        one = (0 - n) % n;
+        r2 = static_cast<uint64_t>(static_cast<unsigned __int128>(one) * one % n);
+    }
+
+    uint64_t reduce(unsigned __int128 t) const {
+        uint64_t m = static_cast<uint64_t>(t) * nInv;
+        uint64_t hi = static_cast<uint64_t>(t >> 64);
+        uint64_t mn = static_cast<uint64_t>((static_cast<unsigned __int128>(m) * n) >> 64);
+        return hi >= mn ? hi - mn : hi - mn + n;
+    }
+
+    uint64_t mul(uint64_t a, uint64_t b) const {
+        return reduce(static_cast<unsigned __int128>(a) * b);
+    }
+
+    uint64_t toMontgomery(uint64_t x) const { return mul(x % n, r2); }
+
+    uint64_t pow(uint64_t base, uint64_t exp) const {   // base in Montgomery form
+        uint64_t result = one;
+        while (exp) {
+            if (exp & 1) result = mul(result, base);
+            base = mul(base, base);
+            exp >>= 1;
+        }
+        return result;
+    }
+};
+
+// Strong probable-prime test to base 2 for odd n > 2, left-to-right so that
+// "multiply by the base" is a modular doubling.
+bool strongProbablePrimeBase2(const Montgomery64 &mont) {
+    const uint64_t minusOne = mont.n - mont.one;
+    uint64_t d = mont.n - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+
+    uint64_t x = mont.one;
+    for (int bit = 63 - __builtin_clzll(d); bit >= 0; --bit) {
+        x = mont.mul(x, x);
+        if ((d >> bit) & 1) {
+            x = (x >= mont.n - x) ? x - (mont.n - x) : x + x;
+        }
+    }
+    if (x == mont.one || x == minusOne) return true;
+    for (int r = 1; r < s; ++r) {
+        x = mont.mul(x, x);
+        if (x == minusOne) return true;
+    }
+    return false;
+}
+
+// Same deterministic strong probable-prime test as isPrimeMillerRabin, with
+// every modular multiplication done in Montgomery form. Two more tricks keep
+// the multiplier busy instead of waiting on one long dependency chain:
+//  - base 2 runs first, left-to-right, so "multiply by the base" is a
+//    doubling; most composites are rejected here;
+//  - the remaining bases share the exponent, so their powers are computed in
+//    lockstep as independent chains.
+bool isPrimeMontgomery(long n) {
+    if (n < 2) return false;
+
+    static const long smallPrimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+    for (long p : smallPrimes) {
+        if (n % p == 0) return n == p;
+    }
+
+    const Montgomery64 mont(static_cast<uint64_t>(n));
+    const uint64_t minusOne = mont.n - mont.one;
+    uint64_t d = mont.n - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+
+    if (!strongProbablePrimeBase2(mont)) return false;
+
+    // Remaining bases, in lockstep. A base that is 0 mod n proves nothing and
+    // is dropped (that only happens for small n).
+    static const uint64_t otherBases[] = { 325, 9375, 28178, 450775, 9780504, 1795265022 };
+    const int kOther = 6;
+    uint64_t base[kOther], acc[kOther];
+    int count = 0;
+    for (int i = 0; i < kOther; ++i) {
+        if (otherBases[i] % mont.n == 0) continue;
+        base[count] = mont.toMontgomery(otherBases[i]);
+        acc[count] = mont.one;
+        ++count;
+    }
+    for (uint64_t e = d; e; e >>= 1) {
+        if (e & 1) {
+            for (int i = 0; i < count; ++i) acc[i] = mont.mul(acc[i], base[i]);
+        }
+        for (int i = 0; i < count; ++i) base[i] = mont.mul(base[i], base[i]);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        uint64_t y = acc[i];
+        if (y == mont.one || y == minusOne) continue;
+
+        bool witness = true;
+        for (int r = 1; r < s && witness; ++r) {
+            y = mont.mul(y, y);
+            if (y == minusOne) witness = false;
+        }
+        if (witness) return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Baillie-PSW.
+//
+// Trial division by the primes below 100, one strong probable-prime test to
+// base 2, then a strong Lucas test with Selfridge's parameters (the first D
+// in 5, -7, 9, -11, ... with Jacobi(D/n) = -1, P = 1, Q = (1 - D) / 4). No
+// composite below 2^64 passes both (every base-2 strong pseudoprime in
+// Feitsma's table fails the Lucas test), so it is as deterministic as the
+// 7-base Miller-Rabin for every long, at the cost of roughly three base-2
+// tests instead of seven. 'primalityTest=bpsw' selects it; 'main verify'
+// cross-checks it against trial division.
+// ----------------------------------------------------------------------------
+static bool g_useBailliePSW = false;
+
+// Jacobi symbol (a/n) for odd n > 0.
+int jacobiSymbol(long a, long n) {
+    a %= n;
+    if (a < 0) a += n;
+    int result = 1;
+    while (a != 0) {
+        while ((a & 1) == 0) {
+            a >>= 1;
+            long r = n & 7;
+            if (r == 3 || r == 5) result = -result;
+        }
+        std::swap(a, n);
+        if ((a & 3) == 3 && (n & 3) == 3) result = -result;
+        a %= n;
+    }
+    return n == 1 ? result : 0;
+}
+
+// Strong Lucas probable-prime test with P = 1 and Q = (1 - D) / 4. With
+// n + 1 = d * 2^s, n passes if U_d == 0 or V_(d * 2^r) == 0 for some
+// 0 <= r < s. Only V is stepped, as the pair (V_k, V_k+1), which takes three
+// independent multiplies per bit; U_d == 0 is then read off the identity
+// D * U_d = 2 * V_(d+1) - P * V_d (D is invertible since Jacobi(D/n) = -1).
+bool strongLucasProbablePrime(const Montgomery64 &mont, long Q) {
+    const uint64_t n = mont.n;
+    auto add = [n](uint64_t a, uint64_t b) { return a >= n - b ? a - (n - b) : a + b; };
+    auto sub = [n](uint64_t a, uint64_t b) { return a >= b ? a - b : a + (n - b); };
+
+    const uint64_t qm = mont.toMontgomery(Q >= 0 ? static_cast<uint64_t>(Q) % n
+                                                 : (n - static_cast<uint64_t>(-Q) % n) % n);
+    uint64_t d = n + 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+
+    // k = 1: V_1 = P = 1, V_2 = P^2 - 2Q, Q^1.
+    uint64_t vk = mont.one, vk1 = sub(mont.one, add(qm, qm)), qk = qm;
+    for (int bit = 62 - __builtin_clzll(d); bit >= 0; --bit) {
+        uint64_t cross = sub(mont.mul(vk, vk1), qk);     // V_2k+1 = V_k V_k+1 - P Q^k
+        if ((d >> bit) & 1) {
+            uint64_t qk1 = mont.mul(qk, qm);
+            vk1 = sub(mont.mul(vk1, vk1), add(qk1, qk1));  // V_2k+2 = V_k+1^2 - 2 Q^k+1
+            vk = cross;
+            qk = mont.mul(qk, qk1);                         // Q^2k+1
+        } else {
+            vk = sub(mont.mul(vk, vk), add(qk, qk));      // V_2k = V_k^2 - 2 Q^k
+            vk1 = cross;
+            qk = mont.mul(qk, qk);                          // Q^2k
+        }
+    }
+    if (add(vk1, vk1) == vk) return true;                   // U_d == 0
+    if (vk == 0) return true;
+    for (int r = 1; r < s; ++r) {
+        vk = sub(mont.mul(vk, vk), add(qk, qk));
+        if (vk == 0) return true;
+        qk = mont.mul(qk, qk);
+    }
+    return false;
+}
+
+bool isPrimeBailliePSW(long n) {
+    if (n < 2) return false;
+
+    static const long smallPrimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47,
+                                        53, 59, 61, 67, 71, 73, 79, 83, 89, 97 };
+    for (long p : smallPrimes) {
+        if (n % p == 0) return n == p;
+    }
+    if (n < 101 * 101) return true;
+
+    const Montgomery64 mont(static_cast<uint64_t>(n));
+    if (!strongProbablePrimeBase2(mont)) return false;
+
+    // A square never gives Jacobi -1, so rule it out before searching for D.
+    long root = integerSqrt(n);
+    if (root * root == n) return false;
+
+    long D = 5;
+    for (;;) {
+        int j = jacobiSymbol(D, n);
+        if (j == -1) break;
+        if (j == 0) return false;   // |D| < n shares a factor with n
+        D = D > 0 ? -(D + 2) : -D + 2;
+    }
+    return strongLucasProbablePrime(mont, (1 - D) / 4);
+}
+
+// The 64-bit test above the crossover: Baillie-PSW or 7-base Miller-Rabin.
+bool isPrimeLarge(long n) {
+    if (g_useBailliePSW) return isPrimeBailliePSW(n);
+    return g_useMontgomery ? isPrimeMontgomery(n) : isPrimeMillerRabin(n);
+}
+
+bool isPrime(long n) {
+    if (g_forceTrialDivision || n < g_millerRabinCrossover) {
+        return isPrimeSingleThread(n);
+    }
+    return isPrimeLarge(n);
+}
+
+// isPrime() for an odd n > 17 already known to have no prime factor <= 17:
+// trial division starts at 19.
+bool isPrimeNoSmallFactors(long n) {
+    if (g_forceTrialDivision || n < g_millerRabinCrossover) {
+        long limit = integerSqrt(n);
+        for (long d = 19; d <= limit; d += 2) {
+            if (n % d == 0) return false;
+        }
+        return true;
+    }
+    return isPrimeLarge(n);
+}
+
+// ----------------------------------------------------------------------------
+// Pre-sieved tiles.
+//
+// Most composites cost isPrime() a division or two before a factor like 3
+// or 7 turns up. Which odd numbers have a prime factor <= 17 repeats with
+// period 2 * 3 * 5 * 7 * 11 * 13 * 17 = 510510, so one period of that
+// pattern (one byte per odd number, 249 KB) is built once and shared
+// read-only. A block of candidates starts as a memcpy of the matching slice,
+// leaving only ~36% of the odd numbers. While sqrt(end) is at most
+// kPresieveSieveLimit those survivors are sieved with the primes 19..sqrt(end)
+// (a few thousand strides per block, far cheaper than testing hundreds of
+// candidates); above it each survivor is tested. Off by default, so Scheme A
+// tests every number as it always has; 'presieve=true' turns it on.
+// ----------------------------------------------------------------------------
+static bool g_presieve = false;
+static const long kPresievePeriod = 510510;
+static const long kPresieveOddPerPeriod = kPresievePeriod / 2;
+static const long kPresieveSieveLimit = 65536;
+
+std::vector<long> basePrimesUpTo(long limit) {
+    std::vector<long> primes;
+    if (limit < 2) return primes;
+
+    std::vector<char> composite(limit + 1, 0);
+    for (long i = 2; i <= limit; ++i) {
+        if (composite[i]) continue;
+        primes.push_back(i);
+        for (long j = i * i; j <= limit; j += i) {
+            composite[j] = 1;
+        }
+    }
+    return primes;
+}
+
+// Primes up to kPresieveSieveLimit, shared read-only.
+const std::vector<long> &presieveSievePrimes() {
+    static const std::vector<long> primes = basePrimesUpTo(kPresieveSieveLimit);
+    return primes;
+}
+
+class PresieveTile {
+public:
+    PresieveTile() : flags_(kPresieveOddPerPeriod) {
+        for (long i = 0; i < kPresieveOddPerPeriod; ++i) {
+            long n = 2 * i + 1;
+            flags_[i] = n % 3 && n % 5 && n % 7 && n % 11 && n % 13 && n % 17;
+        }
+    }
+
+    // out[i] = 1 if firstOdd + 2i has no prime factor <= 17, for i < count.
+    void fill(long firstOdd, long count, uint8_t* out) const {
+        long pos = (firstOdd % kPresievePeriod) / 2;
+        while (count > 0) {
+            long n = std::min(count, kPresieveOddPerPeriod - pos);
+            std::memcpy(out, flags_.data() + pos, n);
+            out += n;
+            count -= n;
+            pos = 0;
+        }
+    }
+
+private:
+    std::vector<uint8_t> flags_;
+};
+
+const PresieveTile &presieveTile() {
+    static const PresieveTile tile;
+    return tile;
+}
+
+// Calls fn(n) for every prime in [start, end], in increasing order: the
+// primes <= 17 directly, then the tile's survivors that pass the sieve or
+// the test. 'block' is scratch space.
+template <typename Fn>
+void forEachPresievedPrime(long start, long end, std::vector<uint8_t> &block, Fn fn) {
+    static const long smallPrimes[] = { 2, 3, 5, 7, 11, 13, 17 };
+    for (long p : smallPrimes) {
+        if (p >= start && p <= end) fn(p);
+    }
+
+    const long firstOdd = start | 1;
+    if (firstOdd > end) return;
+    const long count = (end - firstOdd) / 2 + 1;
+    if (static_cast<long>(block.size()) < count) block.resize(count);
+    presieveTile().fill(firstOdd, count, block.data());
+
+    const long sqrtEnd = integerSqrt(end);
+    if (sqrtEnd > kPresieveSieveLimit) {
+        for (long i = 0; i < count; ++i) {
+            if (!block[i]) continue;
+            long n = firstOdd + 2 * i;
+            if (n > 17 && isPrimeNoSmallFactors(n)) fn(n);
+        }
+        return;
+    }
+
+    const std::vector<long> &primes = presieveSievePrimes();
+    for (size_t k = 7; k < primes.size() && primes[k] <= sqrtEnd; ++k) {   // from 19
+        long p = primes[k];
+        long first = std::max(p * p, ((firstOdd + p - 1) / p) * p);
+        if (first % 2 == 0) first += p;
+        for (long m = first; m <= end; m += 2 * p) block[(m - firstOdd) / 2] = 0;
+    }
+    for (long i = 0; i < count; ++i) {
+        long n = firstOdd + 2 * i;
+        if (block[i] && n > 17) fn(n);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Work-stealing range scheduler.
+//
+// A static split hands the last thread the largest (most expensive) numbers,
+// so the run lasts as long as the slowest chunk. Instead the window is cut
+// into small ranges of 'g_chunkSize' numbers, numbered 0, 1, 2, ..., and each
+// thread starts with a contiguous interval [next, end) of those indices. A
+// thread takes its ranges from the front of its own interval; once that is
+// empty it steals the back half of another thread's remaining interval. Only
+// the two bounds per thread are stored, however many ranges the window holds.
+// ----------------------------------------------------------------------------
+static long g_chunkSize = 1024;
+
+struct WorkRange {
+    long index;   // position of the range in [startNum..endNum]
+    long start;
+    long end;
+};
+
+class WorkStealingScheduler {
+public:
+    WorkStealingScheduler(long numThreads, long startNum, long endNum,
+                          long chunkSize = g_chunkSize)
+        : intervals_(numThreads),
+          startNum_(startNum),
+          endNum_(endNum),
+          chunkSize_(chunkSize) {
+        // Rounded up, so with fewer ranges than threads the first threads
+        // get them, as in the static split.
+        const long numRanges = (endNum - startNum) / chunkSize + 1;
+        auto boundary = [&](long t) {
+            return static_cast<long>((static_cast<__int128>(numRanges) * t + numThreads - 1) / numThreads);
+        };
+        for (long t = 0; t < numThreads; ++t) {
+            intervals_[t].next = boundary(t);
+            intervals_[t].end = boundary(t + 1);
+        }
+    }
+
+    // Next range for 'threadId'; sets 'stolen' if it came from another
+    // thread's interval. Returns false once there is no work left anywhere.
+    bool next(long threadId, WorkRange &out, bool &stolen) {
+        Interval &own = intervals_[threadId];
+        if (popFront(own, out)) {
+            stolen = false;
+            return true;
+        }
+
+        const long numThreads = static_cast<long>(intervals_.size());
+        for (long i = 1; i < numThreads; ++i) {
+            Interval &victim = intervals_[(threadId + i) % numThreads];
+            long first, last;
+            {
+                std::lock_guard<std::mutex> lk(victim.mutex);
+                long remaining = victim.end - victim.next;
+                if (remaining <= 0) continue;
+                last = victim.end;
+                first = last - (remaining + 1) / 2;   // the back half, at least one range
+                victim.end = first;
+            }
+            {
+                std::lock_guard<std::mutex> lk(own.mutex);
+                own.next = first;
+                own.end = last;
+            }
+            if (popFront(own, out)) {
+                stolen = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    // Padded so the locks of neighbouring intervals sit on different cache lines.
+    struct Interval {
+        std::mutex mutex;
+        long next = 0;
+        long end = 0;
+        char padding[64];
+    };
+
+    bool popFront(Interval &interval, WorkRange &out) const {
+        long index;
+        {
+            std::lock_guard<std::mutex> lk(interval.mutex);
+            if (interval.next >= interval.end) return false;
+            index = interval.next++;
+        }
+        out.index = index;
+        out.start = startNum_ + index * chunkSize_;
+        out.end = endNum_ - out.start < chunkSize_ ? endNum_ : out.start + chunkSize_ - 1;
+        return true;
+    }
+
+    std::vector<Interval> intervals_;
+    const long startNum_;
+    const long endNum_;
+    const long chunkSize_;
+};
+
+// Print-after buffers: one per run of consecutive ranges a thread processed,
+// which is its starting interval and each interval it stole, rather than one
+// per range. collect() returns the buffer for 'range', opening a new run when
+// the range does not follow the previous one.
+class RangeRuns {
+public:
+    std::vector<long> &collect(const WorkRange &range) {
+        if (runs_.empty() || range.index != nextIndex_) {
+            runs_.push_back(Run{ range.index, std::vector<long>() });
+        }
+        nextIndex_ = range.index + 1;
+        return runs_.back().primes;
+    }
+
+    // Appends every thread's runs to 'out' in range order. Each run covers
+    // consecutive ranges and the runs do not overlap, so 'out' stays sorted.
+    static void merge(std::vector<RangeRuns> &perThread, std::vector<long> &out) {
+        std::vector<Run*> runs;
+        for (RangeRuns &r : perThread) {
+            for (Run &run : r.runs_) runs.push_back(&run);
+        }
+        std::sort(runs.begin(), runs.end(),
+                  [](const Run* a, const Run* b) { return a->firstIndex < b->firstIndex; });
+        for (const Run* run : runs) {
+            out.insert(out.end(), run->primes.begin(), run->primes.end());
+        }
+    }
+
+private:
+    struct Run {
+        long firstIndex;
+        std::vector<long> primes;
+    };
+    std::vector<Run> runs_;
+    long nextIndex_ = 0;
+};
+
+// Per-thread timings of the last run, printed after the elapsed time.
+struct ThreadTiming {
+    double busyMs = 0;
+    double idleMs = 0;
+    long ranges = 0;
+    long stolen = 0;
+    long primes = 0;
+};
+
+static std::vector<ThreadTiming> g_threadTimings;
+
+// In print-after mode the primes go to this thread's own 'runs', so no lock
+// is needed. Every mode counts the primes in timing.primes.
+void workerRangeSchemeA(long threadId, WorkStealingScheduler &scheduler,
+                        bool printImmediately, ThreadTiming &timing,
+                        RangeRuns &runs) {
+    std::thread::id actualThreadId = std::this_thread::get_id();
+    ThreadStats* stats = attachThreadStats(threadId);   // before the perf_event_open calls
+    PerfScope perf(threadId);
+
+    std::vector<uint8_t> block;
+
+    WorkRange range;
+    bool stolen;
+    auto waitStart = std::chrono::steady_clock::now();
+    while (scheduler.next(threadId, range, stolen)) {
+        auto busyStart = std::chrono::steady_clock::now();
+        if (stats) {
+            stats->scheduleWaitMs += millisBetween(waitStart, busyStart);
+            stats->tested += range.end - range.start + 1;
+        }
+        long count = 0;
+        std::vector<long>* found = printImmediately || g_countOnly ? nullptr : &runs.collect(range);
+        auto report = [&](long n) {
+            ++count;
+            if (printImmediately) {
+                printPrimeLine(threadId, actualThreadId, n);
+            } else if (found) {
+                found->push_back(n);
+            }
+        };
+        if (g_presieve) {
+            forEachPresievedPrime(range.start, range.end, block, report);
+        } else {
+            for (long i = 0; i <= range.end - range.start; ++i) {   // n + 1 may overflow
+                if (isPrime(range.start + i)) report(range.start + i);
+            }
+        }
+        timing.primes += count;
+        timing.busyMs += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - busyStart).count();
+        ++timing.ranges;
+        if (stolen) ++timing.stolen;
+        waitStart = std::chrono::steady_clock::now();
+    }
+    if (stats) {
+        stats->scheduleWaitMs += millisBetween(waitStart, std::chrono::steady_clock::now());
+        stats->primes = timing.primes;
+        stats->computeMs = timing.busyMs - stats->outputWaitMs;
+    }
+    detachThreadStats(stats);
+}
+
+void runSchemeA(long minNumber, long maxNumber, long numThreads, bool printImmediately) {
+    WorkStealingScheduler scheduler(numThreads, minNumber, maxNumber);
+    std::vector<ThreadTiming> timings(numThreads);
+    std::vector<RangeRuns> runs(numThreads);
+
+    g_threadStats.assign(g_stats ? numThreads : 0, ThreadStats());
+
+    auto runStart = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (long i = 0; i < numThreads; ++i) {
+        if (g_stats) g_threadStats[i].spawnedAt = std::chrono::steady_clock::now();
+        threads.emplace_back(workerRangeSchemeA,
+                             i,
+                             std::ref(scheduler),
+                             printImmediately,
+                             std::ref(timings[i]),
+                             std::ref(runs[i]));
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+        if (g_stats) {
+            g_threadStats[i].stopLatencyMs = millisBetween(g_threadStats[i].exitedAt,
+                                                           std::chrono::steady_clock::now());
+        }
+    }
+    double wallMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - runStart).count();
+
+    // Anything a thread did not spend testing numbers, it spent idle
+    // (starting up, contending for an interval, or waiting for the others).
+    for (auto &t : timings) {
+        t.idleMs = std::max(0.0, wallMs - t.busyMs);
+        g_primeCount += t.primes;
+    }
+    g_threadTimings = timings;
+
+    RangeRuns::merge(runs, g_collectedPrimes);
+}
+
+void printThreadTimings() {
+    std::cout << "Per-thread timings:\n"
+              << std::setfill(' ')
+              << std::setw(8) << "thread"
+              << std::setw(12) << "busy ms"
+              << std::setw(12) << "idle ms"
+              << std::setw(10) << "ranges"
+              << std::setw(10) << "steals"
+              << std::setw(12) << "primes" << "\n";
+    std::cout << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < g_threadTimings.size(); ++i) {
+        const ThreadTiming &t = g_threadTimings[i];
+        std::cout << std::setw(8) << i
+                  << std::setw(12) << t.busyMs
+                  << std::setw(12) << t.idleMs
+                  << std::setw(10) << t.ranges
+                  << std::setw(10) << t.stolen
+                  << std::setw(12) << t.primes << "\n";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+}
+
+void printThreadStats() {
+    if (g_threadStats.empty()) return;
+
+    std::cout << "Per-thread statistics:\n"
+              << std::setfill(' ')
+              << std::setw(8) << "thread"
+              << std::setw(13) << "tested"
+              << std::setw(11) << "primes"
+              << std::setw(13) << "compute ms"
+              << std::setw(13) << "sched wait"
+              << std::setw(13) << "output wait"
+              << std::setw(11) << "start us"
+              << std::setw(11) << "stop us" << "\n";
+    std::cout << std::fixed;
+    ThreadStats total;
+    auto printRow = [](const std::string &label, const ThreadStats &t) {
+        std::cout << std::setw(8) << label
+                  << std::setw(13) << t.tested
+                  << std::setw(11) << t.primes
+                  << std::setprecision(1)
+                  << std::setw(13) << t.computeMs
+                  << std::setw(13) << t.scheduleWaitMs
+                  << std::setw(13) << t.outputWaitMs
+                  << std::setw(11) << t.startLatencyMs * 1000
+                  << std::setw(11) << t.stopLatencyMs * 1000 << "\n";
+    };
+    for (size_t i = 0; i < g_threadStats.size(); ++i) {
+        const ThreadStats &t = g_threadStats[i];
+        printRow(t.driver ? "driver" : std::to_string(i), t);
+        // Scheme B and C workers each see every n; the driver's count is the real one.
+        if (t.driver) total.tested = t.tested;
+        else if (!g_threadStats.back().driver) total.tested += t.tested;
+        total.primes += t.primes;
+        total.computeMs += t.computeMs;
+        total.scheduleWaitMs += t.scheduleWaitMs;
+        total.outputWaitMs += t.outputWaitMs;
+        total.startLatencyMs = std::max(total.startLatencyMs, t.startLatencyMs);
+        total.stopLatencyMs = std::max(total.stopLatencyMs, t.stopLatencyMs);
+    }
+    printRow("total", total);
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6)
+              << "  (times summed over threads; start/stop latency is the worst thread)\n";
+}
+
+// ============================================================================
+// SCHEME B: Divisor Splitting
+//
+// For each number n in [max(2, minNumber)..maxNumber]:
+//   - Hand the work to a pool of 'numThreads' threads (from the config),
+//     created once per run.
+//   - Only check divisors in [2..floor(sqrt(n))].
+//   - Partition that set of divisors among the threads, so each thread
+//     checks a subrange. If any thread finds a divisor, n is not prime.
+//
+// The prime numbers are then either printed immediately or after.
+// ============================================================================
+// Early-exit signal shared by the workers checking one n. It is only written
+// once (when a divisor is found), and sits on its own cache line so that the
+// polling reads never contend with unrelated writes.
+struct alignas(64) CancelFlag {
+    std::atomic<bool> set{false};
+};
+
+// Workers look at the flag once every 'g_cancelPollInterval' divisors rather
+// than on every iteration; a late exit only costs a few extra divisions.
+static long g_cancelPollInterval = 128;
+
+void workerCheckDivRange(long n, long startDiv, long endDiv,
+                         CancelFlag &compositeFound) {
+    for (long blockStart = startDiv; blockStart <= endDiv; blockStart += g_cancelPollInterval) {
+        // Early exit if another worker already found a divisor
+        if (compositeFound.set.load(std::memory_order_relaxed)) return;
+
+        long blockEnd = std::min(endDiv, blockStart + g_cancelPollInterval - 1);
+        for (long d = blockStart; d <= blockEnd; ++d) {
+            if (n % d == 0) {
+                compositeFound.set.store(true, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+}
+
+// The original worker, which takes 'flagMutex' on every divisor. Only kept as
+// the baseline for benchmarkCancelFlag().
+void workerCheckDivRangeLocked(long n, long startDiv, long endDiv,
+                               bool &compositeFound,
+                               std::mutex &flagMutex) {
+    for (long d = startDiv; d <= endDiv; ++d) {
+        {
+            std::lock_guard<std::mutex> guard(flagMutex);
+            if (compositeFound) return;
+        }
+        if (n % d == 0) {
+            std::lock_guard<std::mutex> guard(flagMutex);
+            compositeFound = true;
+            return;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Persistent worker pool for Scheme B (and the batched Scheme C).
+//
+// Creating and joining std::threads for every n costs far more than the
+// divisions themselves. The pool starts 'numThreads' workers once; for each n
+// the caller publishes a task (n and the divisor layout) and bumps a
+// generation counter, each worker derives its own sub-range arithmetically,
+// and the workers report back through an atomic countdown. Both sides
+// spin (yielding) for a while before falling back to a condition variable, so
+// back-to-back numbers never touch the kernel when cores are available.
+// ----------------------------------------------------------------------------
+struct DivRange {
+    long startDiv;
+    long endDiv;
+};
+
+// The odd divisors 3, 5, ..., limit split into 'numChunks' contiguous
+// index ranges, the last one absorbing the remainder. Computed on the fly so
+// no divisor list is ever materialized.
+struct DivLayout {
+    long limit;
+    long numChunks;
+    long chunkSize;
+
+    DivRange chunk(long t) const {
+        long totalDivs = (limit - 1) / 2;
+        long startIndex = t * chunkSize;
+        long endIndex = (t == numChunks - 1) ? (totalDivs - 1) : (startIndex + chunkSize - 1);
+        return { 3 + 2 * startIndex, 3 + 2 * endIndex };
+    }
+};
+
+// One unit of pool work; runOn(i) is called once on every worker i.
+class PoolTask {
+public:
+    virtual void runOn(long workerId) = 0;
+
+    // Numbers one round covers, for the 'tested' statistic.
+    virtual long numbersPerRound() const { return 1; }
+
+protected:
+    ~PoolTask() {}
+};
+
+// Scheme B's task: worker i checks chunk i of n's divisors.
+class DivisorCheckTask : public PoolTask {
+public:
+    DivisorCheckTask(long n, const DivLayout &layout, CancelFlag &compositeFound)
+        : n_(n), layout_(layout), compositeFound_(compositeFound) {}
+
+    void runOn(long workerId) override {
+        if (workerId >= layout_.numChunks) return;
+        DivRange r = layout_.chunk(workerId);
+        workerCheckDivRange(n_, r.startDiv, r.endDiv, compositeFound_);
+    }
+
+private:
+    long n_;
+    DivLayout layout_;
+    CancelFlag &compositeFound_;
+};
+
+class DivisorPool {
+public:
+    explicit DivisorPool(long numThreads)
+        : numWorkers_(numThreads) {
+        workers_.reserve(numThreads);
+        for (long i = 0; i < numThreads; ++i) {
+            if (i < static_cast<long>(g_threadStats.size())) {
+                g_threadStats[i].spawnedAt = std::chrono::steady_clock::now();
+            }
+            workers_.emplace_back(&DivisorPool::workerLoop, this, i);
+        }
+    }
+
+    ~DivisorPool() {
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            stop_.store(true);
+            wake_.notify_all();
+        }
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            workers_[i].join();
+            if (i < g_threadStats.size()) {
+                g_threadStats[i].stopLatencyMs = millisBetween(g_threadStats[i].exitedAt,
+                                                               std::chrono::steady_clock::now());
+            }
+        }
+    }
+
+    long size() const { return numWorkers_; }
+
+    // Runs task.runOn(i) on every worker i and returns once all are done.
+    void run(PoolTask &task) {
+        task_ = &task;
+        pending_.store(numWorkers_, std::memory_order_relaxed);
+
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            generation_.fetch_add(1, std::memory_order_release);
+            if (sleepers_ > 0) wake_.notify_all();
+        }
+
+        for (int spins = 0; pending_.load(std::memory_order_acquire) != 0; ++spins) {
+            if (spins < kSpinLimit) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(mutex_);
+            done_.wait(lk, [this] { return pending_.load(std::memory_order_acquire) == 0; });
+        }
+    }
+
+private:
+    static const int kSpinLimit = 1000;
+
+    // Counters span the worker's whole life: opening them around each
+    // workerCheckDivRange call would cost more than the divisions.
+    void workerLoop(long workerId) {
+        ThreadStats* stats = attachThreadStats(workerId);   // before the perf_event_open calls
+        PerfScope perf(workerId);
+        uint64_t seen = 0;
+        for (;;) {
+            auto waitStart = std::chrono::steady_clock::now();
+            for (int spins = 0; generation_.load(std::memory_order_acquire) == seen && !stop_.load(); ++spins) {
+                if (spins < kSpinLimit) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lk(mutex_);
+                ++sleepers_;
+                wake_.wait(lk, [&] { return generation_.load() != seen || stop_.load(); });
+                --sleepers_;
+            }
+            if (stop_.load()) {
+                detachThreadStats(stats);
+                return;
+            }
+            seen = generation_.load(std::memory_order_acquire);
+
+            if (stats) {
+                auto runStart = std::chrono::steady_clock::now();
+                stats->scheduleWaitMs += millisBetween(waitStart, runStart);
+                task_->runOn(workerId);
+                stats->computeMs += millisBetween(runStart, std::chrono::steady_clock::now());
+                stats->tested += task_->numbersPerRound();
+            } else {
+                task_->runOn(workerId);
+            }
+
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lk(mutex_);
+                done_.notify_one();
+            }
+        }
+    }
+
+    const long numWorkers_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    int sleepers_ = 0;
+    std::atomic<bool> stop_{false};
+
+    // Written by run() (generation) and by the workers (pending) at very
+    // different rates, so each gets its own cache line.
+    alignas(64) std::atomic<uint64_t> generation_{0};
+    alignas(64) std::atomic<long> pending_{0};
+
+    // Current task, written by run() before the generation bump.
+    alignas(64) PoolTask* task_ = nullptr;
+};
+
+bool isPrimeByDivisorThreads(long n, DivisorPool &pool) {
+    if (n < 2)  return false;
+    if (n == 2) return true;
+    if (n % 2 == 0) return false;
+
+    long limit = static_cast<long>(std::sqrt(static_cast<long double>(n)));
+    if (limit <= 2) {
+        return true;
+    }
+
+    CancelFlag compositeFound;
+
+    long numThreads = pool.size();
+    long totalDivs = (limit - 1) / 2;   // odd divisors 3, 5, ..., limit
+    long chunkSize = totalDivs / numThreads;
+    if (chunkSize == 0) {
+        chunkSize = totalDivs;
+        numThreads = 1;
+    }
+
+    DivisorCheckTask task(n, DivLayout{ limit, numThreads, chunkSize }, compositeFound);
+    pool.run(task);
+
+    return !compositeFound.set.load();
+}
+
+// With 'stats=true' slot numThreads is the driver: it tests every n, and
+// its schedule wait is the time spent in pool.run() waiting for the workers.
+void runSchemeB(long minNumber, long maxNumber, long numThreads, bool printImmediately) {
+    g_threadStats.assign(g_stats ? numThreads + 1 : 0, ThreadStats());
+    ThreadStats* driver = g_stats ? &g_threadStats[numThreads] : nullptr;
+    if (driver) driver->driver = true;
+    t_threadStats = driver;
+    auto driverStart = std::chrono::steady_clock::now();
+
+    DivisorPool pool(numThreads);
+
+    const long first = std::max(2L, minNumber);
+    for (long i = 0; i <= maxNumber - first; ++i) {   // by offset: n + 1 may overflow
+        const long n = first + i;
+        bool prime;
+        if (driver) {
+            auto runStart = std::chrono::steady_clock::now();
+            prime = isPrimeByDivisorThreads(n, pool);
+            driver->scheduleWaitMs += millisBetween(runStart, std::chrono::steady_clock::now());
+            ++driver->tested;
+            if (prime) ++driver->primes;
+        } else {
+            prime = isPrimeByDivisorThreads(n, pool);
+        }
+        if (prime) {
+            if (printImmediately) {
+                printPrimeLineB(n);
+            } else if (g_countOnly) {
+                ++g_primeCount;
+            } else {
+                g_collectedPrimes.push_back(n);   // only this thread writes it
+            }
+        }
+    }
+
+    if (driver) {
+        driver->computeMs = millisBetween(driverStart, std::chrono::steady_clock::now())
+                            - driver->scheduleWaitMs - driver->outputWaitMs;
+        t_threadStats = nullptr;
+    }
+}
+
+// ============================================================================
+// SCHEME C: Batched Divisor Splitting
+//
+// Same "split the divisors among threads" model as Scheme B, but for a whole
+// block of 'batchSize' candidates at once, so one pool round-trip is
+// amortized over thousands of numbers instead of paid for each n.
+//
+// For the block [lo..hi] the odd divisors 3..sqrt(hi) are split into one
+// chunk per worker. Every worker walks all odd candidates of the block and
+// tests the divisors of its chunk (up to sqrt(n)), recording hits in its own
+// composite bitmap; the bitmaps are OR-ed together after the round. Workers
+// also publish hits in a shared hint bitmap, read with relaxed loads, so
+// they can skip candidates another worker has already ruled out.
+// ============================================================================
+static long g_batchSize = 4096;
+
+class BatchDivisorTask : public PoolTask {
+public:
+    BatchDivisorTask(long lo, long hi, const DivLayout &layout,
+                     std::vector<std::vector<uint64_t>> &localBits,
+                     std::atomic<uint64_t>* hintBits)
+        : lo_(lo), hi_(hi), layout_(layout), localBits_(localBits), hintBits_(hintBits) {}
+
+    long numbersPerRound() const override { return hi_ - lo_ + 1; }
+
+    void runOn(long workerId) override {
+        if (workerId >= layout_.numChunks) return;
+        DivRange r = layout_.chunk(workerId);
+        std::vector<uint64_t> &bits = localBits_[workerId];
+
+        long first = std::max(lo_, 3L);
+        if (first % 2 == 0) ++first;
+        for (long off = 0; off <= hi_ - first; off += 2) {   // n + 2 may overflow
+            const long n = first + off;
+            if (r.startDiv * r.startDiv > n) continue;   // chunk starts above sqrt(n)
+
+            long idx = n - lo_;
+            const uint64_t mask = 1ULL << (idx & 63);
+            std::atomic<uint64_t> &hint = hintBits_[idx >> 6];
+
+            long sincePoll = 0;
+            for (long d = r.startDiv; d <= r.endDiv && d * d <= n; d += 2) {
+                if (++sincePoll == g_cancelPollInterval) {
+                    sincePoll = 0;
+                    if (hint.load(std::memory_order_relaxed) & mask) break;
+                }
+                if (n % d == 0) {
+                    bits[idx >> 6] |= mask;
+                    hint.fetch_or(mask, std::memory_order_relaxed);
+                    break;
+                }
+            }
+        }
+    }
+
+private:
+    long lo_, hi_;
+    DivLayout layout_;
+    std::vector<std::vector<uint64_t>> &localBits_;
+    std::atomic<uint64_t>* hintBits_;
+};
+
+// 'stats=true' uses the same slots as Scheme B: slot numThreads is the
+// driver, which tests every block and merges the workers' bitmaps.
+void runSchemeC(long minNumber, long maxNumber, long numThreads, bool printImmediately) {
+    g_threadStats.assign(g_stats ? numThreads + 1 : 0, ThreadStats());
+    ThreadStats* driver = g_stats ? &g_threadStats[numThreads] : nullptr;
+    if (driver) driver->driver = true;
+    t_threadStats = driver;
+    auto driverStart = std::chrono::steady_clock::now();
+
+    DivisorPool pool(numThreads);
+
+    const long words = (g_batchSize + 63) / 64;
+    std::vector<std::vector<uint64_t>> localBits(numThreads, std::vector<uint64_t>(words));
+    std::unique_ptr<std::atomic<uint64_t>[]> hintBits(new std::atomic<uint64_t>[words]);
+    std::vector<uint64_t> composite(words);
+
+    // Near LONG_MAX lo + g_batchSize can overflow, so the last block is
+    // found by distance and the loop stops there.
+    for (long lo = minNumber; ; lo += g_batchSize) {
+        const long hi = maxNumber - lo < g_batchSize ? maxNumber : lo + g_batchSize - 1;
+
+        for (auto &bits : localBits) std::fill(bits.begin(), bits.end(), 0);
+        for (long w = 0; w < words; ++w) hintBits[w].store(0, std::memory_order_relaxed);
+
+        long limit = integerSqrt(hi);
+        long totalDivs = limit >= 3 ? (limit - 1) / 2 : 0;   // odd divisors 3, 5, ..., limit
+        if (totalDivs > 0) {
+            long chunks = std::min(numThreads, totalDivs);
+            BatchDivisorTask task(lo, hi, DivLayout{ limit, chunks, totalDivs / chunks },
+                                  localBits, hintBits.get());
+            auto runStart = std::chrono::steady_clock::now();
+            pool.run(task);
+            if (driver) {
+                driver->scheduleWaitMs += millisBetween(runStart, std::chrono::steady_clock::now());
+            }
+        }
+        if (driver) driver->tested += hi - lo + 1;
+
+        // Merge the per-worker composite bitmaps.
+        std::fill(composite.begin(), composite.end(), 0);
+        for (const auto &bits : localBits) {
+            for (long w = 0; w < words; ++w) composite[w] |= bits[w];
+        }
+
+        for (long idx = 0; idx <= hi - lo; ++idx) {
+            const long n = lo + idx;
+            bool prime = (n == 2) || (n > 2 && n % 2 == 1 && !((composite[idx >> 6] >> (idx & 63)) & 1));
+            if (!prime) continue;
+            if (driver) ++driver->primes;
+            if (printImmediately) {
+                printPrimeLineB(n);
+            } else if (g_countOnly) {
+                ++g_primeCount;
+            } else {
+                g_collectedPrimes.push_back(n);   // only this thread writes it
+            }
+        }
+        if (hi == maxNumber) break;
+    }
+
+    if (driver) {
+        driver->computeMs = millisBetween(driverStart, std::chrono::steady_clock::now())
+                            - driver->scheduleWaitMs - driver->outputWaitMs;
+        t_threadStats = nullptr;
+    }
+}
+
+// ============================================================================
+// SCHEME S: Segmented Sieve of Eratosthenes
+//
+// The base primes up to sqrt(maxNumber) are sieved once and shared read-only
+// by all threads. [minNumber..maxNumber] is then cut into segments that fit
+// in L1 (odd numbers only, one byte each), and thread t owns segments
+// t, t + numThreads, t + 2*numThreads, ... so that every thread gets a mix of
+// low and high segments.
+//
+// Each segment costs one division per base prime to find its first multiple,
+// so for a narrow window high up (say [10^15, 10^15 + 10^9]) L1-sized
+// segments would spend their time on the ~2 million base primes rather than
+// on the window. Segments therefore grow to about sqrt(maxNumber) numbers.
+//
+// Produces exactly the same primes as Scheme A, in the same A1/A2 formats.
+// ============================================================================
+static const long kSieveSegmentBytes = 32 * 1024;
+
+// Bytes per sieve segment when one byte stands for 'numbersPerByte' numbers:
+// L1-sized, or sqrt(maxNumber) numbers high up, but never more than it takes
+// to hold all of [minNumber..maxNumber].
+long sieveSegmentBytes(long minNumber, long maxNumber, long numbersPerByte) {
+    return std::min(std::max(kSieveSegmentBytes, integerSqrt(maxNumber) / numbersPerByte),
+                    (maxNumber - minNumber) / numbersPerByte + 1);
+}
+
+// In print-after mode the primes go to 'found', which only this thread
+// touches; its segments are visited in increasing order so it stays sorted.
+// In count mode they are only counted, into 'primeCount'.
+void workerSegmentedSieve(long threadId, long numThreads,
+                          long minNumber, long maxNumber,
+                          const std::vector<long> &basePrimes,
+                          bool printImmediately,
+                          std::vector<long> &found,
+                          long &primeCount) {
+    std::thread::id actualThreadId = std::this_thread::get_id();
+    const long segmentBytes = sieveSegmentBytes(minNumber, maxNumber, 2);
+    const long segmentSpan = 2 * segmentBytes;
+    const long firstOdd = minNumber | 1;
+
+    std::vector<char> segment(segmentBytes);
+    long counted = 0;
+
+    // The sieve only stores odd numbers, so 2 is reported by the first thread.
+    if (threadId == 0 && minNumber <= 2) {
+        if (printImmediately) {
+            printPrimeLine(threadId, actualThreadId, 2);
+        } else if (g_countOnly) {
+            ++counted;
+        } else {
+            found.push_back(2);
+        }
+    }
+
+    // Near 2^63 the next segment, multiple or stride can lie past LONG_MAX,
+    // so positions are kept unsigned and compared before they are used.
+    const uint64_t last = static_cast<uint64_t>(maxNumber);
+    const uint64_t stride = static_cast<uint64_t>(numThreads * segmentSpan);
+    for (uint64_t low = firstOdd + threadId * static_cast<uint64_t>(segmentSpan); low <= last;
+         low += stride) {
+        const uint64_t high = std::min(low + segmentSpan - 1, last);
+        long count = static_cast<long>((high - low) / 2 + 1);   // odd numbers low, low + 2, ..., <= high
+        std::fill(segment.begin(), segment.begin() + count, 1);
+
+        for (size_t k = 1; k < basePrimes.size(); ++k) {   // basePrimes[0] == 2
+            const uint64_t p = basePrimes[k];
+            if (p * p > high) break;
+
+            uint64_t first = std::max(p * p, ((low + p - 1) / p) * p);
+            if (first % 2 == 0) first += p;
+            for (uint64_t m = first; m <= high; m += 2 * p) {
+                segment[(m - low) / 2] = 0;
+            }
+        }
+        if (low == 1) segment[0] = 0;   // 1 is not prime
+
+        if (g_countOnly) {
+            for (long i = 0; i < count; ++i) counted += segment[i];
+            continue;
+        }
+        for (long i = 0; i < count; ++i) {
+            if (!segment[i]) continue;
+            long n = static_cast<long>(low + 2 * i);
+            if (printImmediately) {
+                printPrimeLine(threadId, actualThreadId, n);
+            } else {
+                found.push_back(n);
+            }
+        }
+    }
+    primeCount = counted;
+}
+
+// k-way merge of individually sorted buffers into 'out'.
+void mergeSortedBuffers(const std::vector<std::vector<long>> &buffers, std::vector<long> &out) {
+    typedef std::pair<long, size_t> Head;   // (value, buffer)
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    std::vector<size_t> pos(buffers.size(), 0);
+
+    size_t total = 0;
+    for (size_t b = 0; b < buffers.size(); ++b) {
+        total += buffers[b].size();
+        if (!buffers[b].empty()) heads.push(Head(buffers[b][0], b));
+    }
+    out.reserve(out.size() + total);
+
+    while (!heads.empty()) {
+        Head h = heads.top();
+        heads.pop();
+        out.push_back(h.first);
+        if (++pos[h.second] < buffers[h.second].size()) {
+            heads.push(Head(buffers[h.second][pos[h.second]], h.second));
+        }
+    }
+}
+
+void runSchemeS(long minNumber, long maxNumber, long numThreads, bool printImmediately) {
+    std::vector<long> basePrimes = basePrimesUpTo(integerSqrt(maxNumber));
+    std::vector<std::vector<long>> found(numThreads);
+    std::vector<long> counts(numThreads, 0);
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (long i = 0; i < numThreads; ++i) {
+        threads.emplace_back(workerSegmentedSieve,
+                             i,
+                             numThreads,
+                             minNumber,
+                             maxNumber,
+                             std::cref(basePrimes),
+                             printImmediately,
+                             std::ref(found[i]),
+                             std::ref(counts[i]));
+    }
+
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    for (long c : counts) g_primeCount += c;
+
+    // Each thread's buffer is sorted but the segments interleave.
+    mergeSortedBuffers(found, g_collectedPrimes);
+}
+
+// ============================================================================
+// PERSISTENT PRIME CACHE
+//
+// A file holding the Scheme W bitmap (see below) for a prefix [0, 30 * N) of
+// the numbers, so later runs with the same or a larger maxNumber only sieve
+// what lies beyond it:
+//
+//   offset  size  field
+//        0     8  magic "PRIMEW30"
+//        8     4  version (1)
+//       12     4  reserved (0)
+//       16     8  N, number of wheel bytes that follow
+//       24     N  wheel bytes, byte k covering [30k, 30k + 30)
+//
+// Readers mmap the file read-only. Writers never modify a cache in place:
+// they write a complete new file next to it and rename() it over the old
+// one, so a concurrent reader keeps a consistent (older) mapping and never
+// sees a half-written file. Concurrent writers simply race; the last
+// rename wins and every version is valid.
+// ============================================================================
+static const char kPrimeCacheMagic[8] = { 'P', 'R', 'I', 'M', 'E', 'W', '3', '0' };
+static const uint32_t kPrimeCacheVersion = 1;
+static const size_t kPrimeCacheHeaderSize = 24;
+
+class PrimeCache {
+public:
+    PrimeCache() {}
+    PrimeCache(const PrimeCache &) = delete;
+    PrimeCache &operator=(const PrimeCache &) = delete;
+
+    ~PrimeCache() {
+        if (map_) munmap(map_, mapSize_);
+    }
+
+    // Maps 'path' if it exists and is a valid cache; otherwise stays empty.
+    // A missing file is not an error, a corrupt one is reported and ignored.
+    void open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= kPrimeCacheHeaderSize) {
+            mapSize_ = static_cast<size_t>(st.st_size);
+            void* map = mmap(nullptr, mapSize_, PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) map_ = map;
+        }
+        ::close(fd);
+
+        const unsigned char* header = static_cast<const unsigned char*>(map_);
+        if (!map_ ||
+            std::memcmp(header, kPrimeCacheMagic, sizeof(kPrimeCacheMagic)) != 0 ||
+            static_cast<uint32_t>(getU64LE(header + 8)) != kPrimeCacheVersion ||
+            getU64LE(header + 16) != mapSize_ - kPrimeCacheHeaderSize) {
+            std::cerr << "Ignoring invalid prime cache: " << path << std::endl;
+            if (map_) munmap(map_, mapSize_);
+            map_ = nullptr;
+            return;
+        }
+        coveredBytes_ = static_cast<long>(mapSize_ - kPrimeCacheHeaderSize);
+    }
+
+    long coveredBytes() const { return coveredBytes_; }
+
+    const uint8_t* bytes() const {
+        return map_ ? static_cast<const uint8_t*>(map_) + kPrimeCacheHeaderSize : nullptr;
+    }
+
+    // Atomically replaces 'path' with a cache of 'prefix' followed by 'tail'.
+    static bool write(const std::string &path,
+                      const uint8_t* prefix, long prefixBytes,
+                      const uint8_t* tail, long tailBytes) {
+        std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            unsigned char header[kPrimeCacheHeaderSize] = {};
+            std::memcpy(header, kPrimeCacheMagic, sizeof(kPrimeCacheMagic));
+            putU32LE(header + 8, kPrimeCacheVersion);
+            putU64LE(header + 16, static_cast<uint64_t>(prefixBytes + tailBytes));
+            out.write(reinterpret_cast<const char*>(header), sizeof(header));
+            if (prefixBytes > 0) out.write(reinterpret_cast<const char*>(prefix), prefixBytes);
+            if (tailBytes > 0) out.write(reinterpret_cast<const char*>(tail), tailBytes);
+            if (!out) {
+                std::cerr << "Could not write prime cache: " << tmpPath << std::endl;
+                std::remove(tmpPath.c_str());
+                return false;
+            }
+        }
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::cerr << "Could not replace prime cache: " << path << std::endl;
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void* map_ = nullptr;
+    size_t mapSize_ = 0;
+    long coveredBytes_ = 0;
+};
+
+// ============================================================================
+// SCHEME W: Wheel-30 Bit-Packed Sieve
+//
+// Only numbers coprime to 30 can be prime (apart from 2, 3 and 5), and there
+// are exactly 8 of them in every block of 30. Byte k of the bitmap therefore
+// covers [30k, 30k + 30), bit i standing for 30k + kWheelResidues[i]; a set
+// bit means "prime". That is 15x less memory than one byte per number.
+//
+// The bitmap is split into one contiguous byte range per thread, and each
+// thread sieves its range in L1-sized blocks using the shared base primes
+// (larger for high windows, as in Scheme S).
+// ============================================================================
+static const int kWheelResidues[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+static const int kWheelGaps[8]     = { 6, 4, 2, 4, 2, 4, 6, 2 };   // residue i -> i + 1
+static const int kWheelBitOf[30]   = {
+    -1,  0, -1, -1, -1, -1, -1,  1, -1, -1,
+    -1,  2, -1,  3, -1, -1, -1,  4, -1,  5,
+    -1, -1, -1,  6, -1, -1, -1, -1, -1,  7
+};
+
+// Clears the multiples of the base primes (>= 7) in wheel bytes
+// [byteLo, byteHi); block[0] holds byte byteLo (i.e. numbers 30 * byteLo...).
+void crossOffWheelBlock(uint8_t* block, long byteLo, long byteHi,
+                        const std::vector<long> &basePrimes) {
+    // Unsigned: the last byte's numbers and strides can pass LONG_MAX.
+    const uint64_t lowNum = 30 * static_cast<uint64_t>(byteLo);
+    const uint64_t highNum = 30 * static_cast<uint64_t>(byteHi);   // exclusive
+
+    for (size_t k = 3; k < basePrimes.size(); ++k) {   // skip 2, 3, 5
+        const uint64_t p = basePrimes[k];
+        if (p * p >= highNum) break;
+
+        uint64_t start = std::max(p * p, lowNum);
+        uint64_t q = (start + p - 1) / p;
+        while (kWheelBitOf[q % 30] < 0) ++q;
+
+        int idx = kWheelBitOf[q % 30];
+        for (uint64_t m = p * q; m < highNum; m += p * kWheelGaps[idx], idx = (idx + 1) & 7) {
+            block[m / 30 - byteLo] &= static_cast<uint8_t>(~(1u << kWheelBitOf[m % 30]));
+        }
+    }
+}
+
+// Calls fn(n) for every set bit in wheel bytes [byteLo, byteHi), in
+// increasing order; block[0] holds byte byteLo. Reads 8 bytes at a time and
+// walks the set bits with ctz; the byte to word mapping assumes a
+// little-endian target.
+template <typename Fn>
+void forEachWheelPrime(const uint8_t* block, long byteLo, long byteHi, Fn fn) {
+    const long numBytes = byteHi - byteLo;
+    long i = 0;
+    for (; i + 8 <= numBytes; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, block + i, sizeof(word));
+        while (word) {
+            int b = __builtin_ctzll(word);
+            fn(30 * (byteLo + i + (b >> 3)) + kWheelResidues[b & 7]);
+            word &= word - 1;
+        }
+    }
+    for (; i < numBytes; ++i) {
+        unsigned byte = block[i];
+        while (byte) {
+            int b = __builtin_ctz(byte);
+            fn(30 * (byteLo + i) + kWheelResidues[b]);
+            byte &= byte - 1;
+        }
+    }
+}
+
+// Number of set bits (primes) in wheel bytes block[0..numBytes).
+long countWheelPrimes(const uint8_t* block, long numBytes) {
+    long count = 0;
+    long i = 0;
+    for (; i + 8 <= numBytes; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, block + i, sizeof(word));
+        count += __builtin_popcountll(word);
+    }
+    for (; i < numBytes; ++i) {
+        count += __builtin_popcount(block[i]);
+    }
+    return count;
+}
+
+// Sieves wheel bytes [byteLo, byteHi) into bits (bits[0] holds byte byteLo).
+// Without a 'bits' array each block is sieved into a scratch buffer and only
+// printed or counted; in count mode the primes found go to 'primeCount'.
+void workerWheelSieve(long threadId, long minNumber, long maxNumber, uint8_t* bits,
+                      long byteLo, long byteHi,
+                      const std::vector<long> &basePrimes,
+                      bool printImmediately, long &primeCount) {
+    std::thread::id actualThreadId = std::this_thread::get_id();
+    const long blockBytes = std::min(sieveSegmentBytes(minNumber, maxNumber, 30), byteHi - byteLo);
+    const long firstByte = minNumber / 30;
+    const long lastByte = maxNumber / 30;
+
+    std::vector<uint8_t> scratch(bits ? 0 : blockBytes);
+    long counted = 0;
+
+    if (threadId == 0 && printImmediately) {
+        for (long p : { 2L, 3L, 5L }) {
+            if (p >= minNumber && p <= maxNumber) printPrimeLine(threadId, actualThreadId, p);
+        }
+    }
+
+    for (long lo = byteLo; lo < byteHi; lo += blockBytes) {
+        long hi = std::min(lo + blockBytes, byteHi);
+        uint8_t* block = bits ? bits + (lo - byteLo) : scratch.data();
+
+        std::memset(block, 0xFF, hi - lo);
+        if (lo == 0) block[0] &= static_cast<uint8_t>(~1u);   // 1 is not prime
+        if (lo <= firstByte && firstByte < hi) {
+            // Drop residues of the first byte that lie below minNumber.
+            for (int b = 0; b < 8; ++b) {
+                if (30 * firstByte + kWheelResidues[b] < minNumber) {
+                    block[firstByte - lo] &= static_cast<uint8_t>(~(1u << b));
+                }
+            }
+        }
+        if (hi - 1 == lastByte) {
+            // Drop residues of the last byte that lie beyond maxNumber.
+            for (int b = 0; b < 8; ++b) {
+                if (kWheelResidues[b] > maxNumber - 30 * lastByte) {
+                    block[lastByte - lo] &= static_cast<uint8_t>(~(1u << b));
+                }
+            }
+        }
+        crossOffWheelBlock(block, lo, hi, basePrimes);
+
+        if (printImmediately) {
+            forEachWheelPrime(block, lo, hi, [&](long n) {
+                printPrimeLine(threadId, actualThreadId, n);
+            });
+        } else if (g_countOnly) {
+            counted += countWheelPrimes(block, hi - lo);
+        }
+    }
+    primeCount = counted;
+}
+
+// Sieves wheel bytes [byteLo, byteHi) into bits (bits[0] holds byte byteLo,
+// or no array at all), one contiguous slice per thread. Returns the number of
+// primes found in count mode.
+long sieveWheelBytes(long minNumber, long maxNumber, long numThreads, uint8_t* bits,
+                     long byteLo, long byteHi,
+                     const std::vector<long> &basePrimes,
+                     bool printImmediately) {
+    const long numBytes = byteHi - byteLo;
+    std::vector<long> counts(numThreads, 0);
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (long i = 0; i < numThreads; ++i) {
+        long sliceLo = byteLo + numBytes * i / numThreads;
+        long sliceHi = byteLo + numBytes * (i + 1) / numThreads;
+        threads.emplace_back(workerWheelSieve,
+                             i,
+                             minNumber,
+                             maxNumber,
+                             bits ? bits + (sliceLo - byteLo) : nullptr,
+                             sliceLo,
+                             sliceHi,
+                             std::cref(basePrimes),
+                             printImmediately,
+                             std::ref(counts[i]));
+    }
+
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    long total = 0;
+    for (long c : counts) total += c;
+    return total;
+}
+
+// With a cache file (print-after and count only), the bytes it already
+// covers are read straight from the mapping and only the rest of the window
+// is sieved. The cache is a prefix [0, 30 * N), so it is extended only when
+// the window starts inside it; a window entirely beyond it is sieved without
+// the cache. The whole bitmap is kept in memory only when it is collected or
+// written back; otherwise each thread reuses one block.
+void runSchemeW(long minNumber, long maxNumber, long numThreads, bool printImmediately,
+                const std::string &cacheFile) {
+    std::vector<long> basePrimes = basePrimesUpTo(integerSqrt(maxNumber));
+    const long firstByte = minNumber / 30;
+    const long totalBytes = maxNumber / 30 + 1;
+    const long fullBytes = maxNumber / 30 + (maxNumber % 30 == 29);   // bytes entirely <= maxNumber
+
+    PrimeCache cache;
+    bool useCache = !cacheFile.empty() && !printImmediately;
+    if (useCache) {
+        cache.open(cacheFile);
+    }
+    // Bytes [firstByte, cachedEnd) come from the cache. The last byte may
+    // need masking at maxNumber, so it is always sieved.
+    const long covered = cache.coveredBytes();
+    const long cachedEnd = std::max(firstByte, std::min(covered, totalBytes - 1));
+
+    // Extending needs the sieved bytes to start exactly at the end of the
+    // cache, unmasked: no wheel residue of that byte may be below minNumber.
+    const bool extendCache = useCache && fullBytes > covered && minNumber <= 30 * covered + 1;
+    const bool keepBits = (!printImmediately && !g_countOnly) || extendCache;
+
+    std::vector<uint8_t> bits(keepBits ? totalBytes - cachedEnd : 0);
+    long sievedCount = sieveWheelBytes(minNumber, maxNumber, numThreads,
+                                       keepBits ? bits.data() : nullptr, cachedEnd, totalBytes,
+                                       basePrimes, printImmediately);
+
+    if (useCache) {
+        if (cachedEnd > firstByte) {
+            std::cout << "Prime cache: reused [" << minNumber << ".." << 30 * cachedEnd
+                      << "), sieved [" << 30 * cachedEnd << ".." << maxNumber << "]\n";
+        } else {
+            std::cout << "Prime cache: nothing cached in [" << minNumber << ".." << maxNumber
+                      << "], sieved all of it\n";
+        }
+        if (extendCache) {
+            PrimeCache::write(cacheFile, cache.bytes(), cachedEnd,
+                              bits.data(), fullBytes - cachedEnd);
+        }
+    }
+
+    if (printImmediately) return;
+
+    for (long p : { 2L, 3L, 5L }) {
+        if (p < minNumber || p > maxNumber) continue;
+        if (g_countOnly) {
+            ++g_primeCount;
+        } else {
+            g_collectedPrimes.push_back(p);
+        }
+    }
+    // The cache holds the whole first byte, including residues below minNumber.
+    if (cachedEnd > firstByte) {
+        forEachWheelPrime(cache.bytes() + firstByte, firstByte, firstByte + 1, [&](long n) {
+            if (n < minNumber) return;
+            if (g_countOnly) {
+                ++g_primeCount;
+            } else {
+                g_collectedPrimes.push_back(n);
+            }
+        });
+        if (g_countOnly) {
+            g_primeCount += countWheelPrimes(cache.bytes() + firstByte + 1, cachedEnd - firstByte - 1);
+        } else {
+            forEachWheelPrime(cache.bytes() + firstByte + 1, firstByte + 1, cachedEnd, [&](long n) {
+                g_collectedPrimes.push_back(n);
+            });
+        }
+    }
+    if (g_countOnly) {
+        g_primeCount += sievedCount;
+    } else {
+        forEachWheelPrime(bits.data(), cachedEnd, totalBytes, [&](long n) {
+            g_collectedPrimes.push_back(n);
+        });
+    }
+}
+
+// ============================================================================
+// SCHEME K: Bucket Sieve for Large Ranges
+//
+// Near 10^12 most sieving primes are larger than an L1-sized segment and hit
+// it once or not at all, yet Schemes S and W look at every one of them in
+// every segment. Following Oliveira e Silva, the sieving primes are split:
+//   - small primes (fewer odd numbers apart than a segment holds) keep the
+//     index of their next multiple and cross off every segment directly;
+//   - each large prime sits in the bucket of the segment its next multiple
+//     falls in. Sieving a segment empties its bucket, crossing off one
+//     multiple per entry and moving the entry to the bucket of its following
+//     multiple, so a large prime costs nothing in the segments it skips.
+//
+// Each thread sieves one contiguous slice of [minNumber..maxNumber] with its
+// own ring of buckets; the bucket vectors keep their capacity, so the steady
+// state makes no allocations. Segments hold one byte per odd number and
+// start as a copy of Scheme A's pre-sieve tile, so 3..17 are never sieved.
+// ============================================================================
+static const long kBucketSegmentBytes = 32 * 1024;
+
+struct BucketEntry {
+    uint32_t prime;
+    uint32_t offset;   // odd index of the next multiple within its segment
+};
+
+// Sieves the odd numbers 2i + 1 for i in [iLo, iHi). As in Scheme S, the
+// primes go to 'found' in print-after mode and to 'primeCount' in count mode.
+void workerBucketSieve(long threadId, long minNumber, long maxNumber, long iLo, long iHi,
+                       const std::vector<long> &basePrimes,
+                       bool printImmediately,
+                       std::vector<long> &found,
+                       long &primeCount) {
+    std::thread::id actualThreadId = std::this_thread::get_id();
+    const long segmentSize = kBucketSegmentBytes;
+    const long numSegments = (iHi - iLo + segmentSize - 1) / segmentSize;
+    long counted = 0;
+
+    auto report = [&](long n) {
+        if (printImmediately) {
+            printPrimeLine(threadId, actualThreadId, n);
+        } else if (g_countOnly) {
+            ++counted;
+        } else {
+            found.push_back(n);
+        }
+    };
+
+    // The tile removes 3..17 along with their multiples; the first slice
+    // reports them (and 2, which has no odd index) itself.
+    if (threadId == 0) {
+        for (long p : { 2L, 3L, 5L, 7L, 11L, 13L, 17L }) {
+            if (p >= minNumber && p <= maxNumber) report(p);
+        }
+    }
+
+    // Primes 19..sqrt(max): a multiple m = 2j + 1 is followed by m + 2p,
+    // i.e. j + p, so a prime's step in odd indices is the prime itself.
+    const long lastNumber = 2 * (iHi - 1) + 1;   // 2 * iHi may be 2^63
+    std::vector<long> smallPrimes, smallNext;
+    const long maxPrime = basePrimes.empty() ? 0 : basePrimes.back();
+    const long ringSize = std::min(maxPrime / segmentSize + 2, numSegments + 1);
+    std::vector<std::vector<BucketEntry>> buckets(ringSize);
+
+    // A large prime is at most maxPrime / segmentSize + 1 segments from its
+    // next multiple, which the ring covers, but its first multiple p^2 can be
+    // much further out. Those wait in 'pending', in ascending order (so also
+    // by p^2), and join the ring once their first segment is within reach.
+    std::vector<BucketEntry> pending;
+    std::vector<long> pendingSeg;
+    size_t nextPending = 0;
+
+    for (size_t k = 7; k < basePrimes.size(); ++k) {   // from 19
+        long p = basePrimes[k];
+        if (p * p > lastNumber) break;
+        uint64_t q = (2 * static_cast<uint64_t>(iLo) + p) / p;   // may pass LONG_MAX
+        if (q % 2 == 0) ++q;
+        long j = static_cast<long>((std::max<uint64_t>(p * p, q * p) - 1) / 2);
+        if (p < segmentSize) {
+            smallPrimes.push_back(p);
+            smallNext.push_back(j);
+        } else if (j < iHi) {
+            long seg = (j - iLo) / segmentSize;
+            pending.push_back({ static_cast<uint32_t>(p),
+                                static_cast<uint32_t>(j - iLo - seg * segmentSize) });
+            pendingSeg.push_back(seg);
+        }
+    }
+
+    std::vector<uint8_t> segment(segmentSize);
+    for (long s = 0; s < numSegments; ++s) {
+        const long segLo = iLo + s * segmentSize;
+        const long len = std::min(segmentSize, iHi - segLo);
+        const long segHi = segLo + len;
+
+        for (; nextPending < pending.size() && pendingSeg[nextPending] < s + ringSize; ++nextPending) {
+            buckets[pendingSeg[nextPending] % ringSize].push_back(pending[nextPending]);
+        }
+
+        presieveTile().fill(2 * segLo + 1, len, segment.data());
+        if (segLo == 0) segment[0] = 0;   // 1 is not prime
+
+        for (size_t k = 0; k < smallPrimes.size(); ++k) {
+            const long p = smallPrimes[k];
+            long j = smallNext[k];
+            for (; j < segHi; j += p) segment[j - segLo] = 0;
+            smallNext[k] = j;
+        }
+
+        std::vector<BucketEntry> &bucket = buckets[s % ringSize];
+        for (const BucketEntry &e : bucket) {
+            segment[e.offset] = 0;
+            long j = segLo + e.offset + e.prime;
+            if (j < iHi) {
+                long seg = (j - iLo) / segmentSize;   // always a later segment
+                buckets[seg % ringSize].push_back({ e.prime,
+                                                    static_cast<uint32_t>(j - iLo - seg * segmentSize) });
+            }
+        }
+        bucket.clear();
+
+        if (g_countOnly) {
+            counted += countWheelPrimes(segment.data(), len);   // bytes are 0 or 1
+            continue;
+        }
+        for (long i = 0; i < len; ++i) {
+            if (segment[i]) report(2 * (segLo + i) + 1);
+        }
+    }
+    primeCount = counted;
+}
+
+void runSchemeK(long minNumber, long maxNumber, long numThreads, bool printImmediately) {
+    std::vector<long> basePrimes = basePrimesUpTo(integerSqrt(maxNumber));
+    const long iLo = minNumber / 2;           // first odd number >= minNumber
+    const long iHi = (maxNumber - 1) / 2 + 1; // past the last odd number <= maxNumber
+    std::vector<std::vector<long>> found(numThreads);
+    std::vector<long> counts(numThreads, 0);
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (long i = 0; i < numThreads; ++i) {
+        threads.emplace_back(workerBucketSieve,
+                             i,
+                             minNumber,
+                             maxNumber,
+                             iLo + (iHi - iLo) * i / numThreads,
+                             iLo + (iHi - iLo) * (i + 1) / numThreads,
+                             std::cref(basePrimes),
+                             printImmediately,
+                             std::ref(found[i]),
+                             std::ref(counts[i]));
+    }
+
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    // Slices are contiguous and in order, so concatenating keeps it sorted.
+    for (long i = 0; i < numThreads; ++i) {
+        g_primeCount += counts[i];
+        g_collectedPrimes.insert(g_collectedPrimes.end(), found[i].begin(), found[i].end());
+    }
+}
+
+// ============================================================================
+// SCHEME L: Lagarias-Miller-Odlyzko Prime Counting
+//
+// Every sieve above is linear in maxNumber. LMO counts the primes up to x in
+// about x^(2/3) operations and x^(1/3) memory, without looking at most of
+// the numbers. With y = alpha * cbrt(x) and a = pi(y):
+//
+//   pi(x) = phi(x, a) + a - 1 - P2(x, a)
+//
+// phi(x, a), the count of n <= x free of the first a primes, splits into
+// ordinary leaves S1 (one term per squarefree n <= y) and special leaves S2,
+// which need phi(x / n, b) for arguments below x / y. Those are read off a
+// segmented sieve of [1, x / y) that removes one prime at a time, with a
+// Fenwick tree counting what is left of the segment. P2 counts the n <= x
+// with exactly two prime factors above y, from a segmented count of primes
+// in (sqrt(x), x / y].
+//
+// S2 and P2 run on 'numThreads' threads. S2 segments are handed out one at
+// a time; a segment does not know how many numbers the earlier ones left,
+// so it returns that count and the sum of mu(m) over its leaves per prime,
+// and the results are merged in segment order.
+// ============================================================================
+static const long kLmoDirectLimit = 1000000;   // below this, just sieve
+
+long integerCbrt(long n) {
+    long r = static_cast<long>(std::cbrt(static_cast<long double>(n)));
+    while (r > 0 && r > n / r / r) --r;       // as in integerSqrt, no overflow
+    while (r + 1 <= n / (r + 1) / (r + 1)) ++r;
+    return r;
+}
+
+// phi(x, c) for the first c <= 6 primes, from one period 2 * 3 * ... * p_c.
+class PhiTiny {
+public:
+    explicit PhiTiny(long c) : c_(c), period_(1) {
+        static const long smallPrimes[] = { 2, 3, 5, 7, 11, 13 };
+        for (long i = 0; i < c; ++i) period_ *= smallPrimes[i];
+        counts_.assign(period_ + 1, 0);   // counts_[r]: survivors in [1, r]
+        for (long r = 1; r <= period_; ++r) {
+            bool survives = true;
+            for (long i = 0; i < c && survives; ++i) survives = r % smallPrimes[i] != 0;
+            counts_[r] = counts_[r - 1] + (survives ? 1 : 0);
+        }
+    }
+
+    long c() const { return c_; }
+
+    long operator()(long x) const {
+        return (x / period_) * counts_[period_] + counts_[x % period_];
+    }
+
+private:
+    long c_;
+    long period_;
+    std::vector<int32_t> counts_;
+};
+
+// Primes (1-based, primes[0] == 0), least prime factor and Moebius function
+// of every n <= y.
+struct LmoTables {
+    explicit LmoTables(long y) : lpf(y + 1, 0), mu(y + 1, 1) {
+        primes.push_back(0);
+        lpf[1] = std::numeric_limits<int32_t>::max();
+        for (long p = 2; p <= y; ++p) {
+            if (lpf[p] != 0) continue;
+            primes.push_back(static_cast<int32_t>(p));
+            for (long m = p; m <= y; m += p) {
+                if (lpf[m] == 0) lpf[m] = static_cast<int32_t>(p);
+                mu[m] = static_cast<int8_t>(-mu[m]);
+            }
+            for (long m = p * p; m <= y; m += p * p) mu[m] = 0;
+        }
+    }
+
+    long piY() const { return static_cast<long>(primes.size()) - 1; }
+
+    std::vector<int32_t> primes;
+    std::vector<int32_t> lpf;
+    std::vector<int8_t> mu;
+};
+
+// Counts the numbers still unsieved in a segment, by position.
+class FenwickCounter {
+public:
+    void build(const std::vector<char> &sieve, long len) {
+        tree_.assign(sieve.begin(), sieve.begin() + len);
+        for (long i = 0; i < len; ++i) {
+            long j = i | (i + 1);
+            if (j < len) tree_[j] += tree_[i];
+        }
+    }
+
+    // Unsieved positions in [0, pos].
+    long prefix(long pos) const {
+        long sum = 0;
+        for (; pos >= 0; pos = (pos & (pos + 1)) - 1) sum += tree_[pos];
+        return sum;
+    }
+
+    void remove(long pos) {
+        for (long len = static_cast<long>(tree_.size()); pos < len; pos |= pos + 1) --tree_[pos];
+    }
+
+private:
+    std::vector<int32_t> tree_;
+};
+
+// One S2 segment [low, high). For the primes b = c + 1, c + 2, ... that
+// still have leaves here, phi[i] and muSum[i] belong to b = c + 1 + i.
+struct LmoSegmentResult {
+    long s2 = 0;                 // assuming nothing was left before 'low'
+    std::vector<long> phi;       // unsieved in the segment before removing p_b
+    std::vector<long> muSum;     // sum of -mu(m) over the segment's leaves
+};
+
+void lmoSieveSegment(long x, long y, const LmoTables &t, long c,
+                     long low, long high,
+                     std::vector<char> &sieve, FenwickCounter &tree,
+                     LmoSegmentResult &out) {
+    const long len = high - low;
+    const long piY = t.piY();
+
+    // phi(., c) is what is left after removing the first c primes.
+    sieve.assign(len, 1);
+    for (long b = 1; b <= c; ++b) {
+        long p = t.primes[b];
+        for (long k = ((low + p - 1) / p) * p; k < high; k += p) sieve[k - low] = 0;
+    }
+    tree.build(sieve, len);
+
+    for (long b = c + 1; b < piY; ++b) {
+        const long prime = t.primes[b];
+        const long minM = std::max(x / (prime * high), y / prime);
+        const long maxM = std::min(x / (prime * low), y);
+        if (prime >= maxM) break;   // no leaves for this or any larger prime
+
+        // Leaves n = prime * m with x / n in [low, high).
+        long muSum = 0;
+        for (long m = maxM; m > minM; --m) {
+            if (t.mu[m] != 0 && prime < t.lpf[m]) {
+                long xn = x / (prime * m);
+                out.s2 -= t.mu[m] * tree.prefix(xn - low);
+                muSum -= t.mu[m];
+            }
+        }
+        out.phi.push_back(tree.prefix(len - 1));
+        out.muSum.push_back(muSum);
+
+        for (long k = ((low + prime - 1) / prime) * prime; k < high; k += prime) {
+            if (sieve[k - low]) {
+                sieve[k - low] = 0;
+                tree.remove(k - low);
+            }
+        }
+    }
+}
+
+// Special leaves S2, summed over all segments of [1, x / y].
+long lmoS2(long x, long y, const LmoTables &t, long c, long numThreads) {
+    const long limit = x / y + 1;
+    long segmentSize = 1;
+    while (segmentSize < integerSqrt(limit)) segmentSize <<= 1;
+    const long numSegments = (limit - 1 + segmentSize - 1) / segmentSize;
+
+    std::atomic<long> nextSegment{0};
+    std::mutex mergeMutex;
+    std::vector<std::unique_ptr<LmoSegmentResult>> pending(numSegments);
+    long nextToMerge = 0;
+    std::vector<long> phiBefore(t.piY() + 1, 0);   // unsieved before the merged segments
+    long s2 = 0;
+
+    auto worker = [&]() {
+        std::vector<char> sieve;
+        FenwickCounter tree;
+        long i;
+        while ((i = nextSegment.fetch_add(1)) < numSegments) {
+            long low = 1 + i * segmentSize;
+            long high = std::min(low + segmentSize, limit);
+            std::unique_ptr<LmoSegmentResult> r(new LmoSegmentResult);
+            lmoSieveSegment(x, y, t, c, low, high, sieve, tree, *r);
+
+            // Merge every segment that is now ready, in order.
+            std::lock_guard<std::mutex> lk(mergeMutex);
+            pending[i] = std::move(r);
+            while (nextToMerge < numSegments && pending[nextToMerge]) {
+                const LmoSegmentResult &done = *pending[nextToMerge];
+                s2 += done.s2;
+                for (size_t k = 0; k < done.phi.size(); ++k) {
+                    long b = c + 1 + static_cast<long>(k);
+                    s2 += phiBefore[b] * done.muSum[k];
+                    phiBefore[b] += done.phi[k];
+                }
+                pending[nextToMerge++].reset();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (long i = 0; i < numThreads; ++i) threads.emplace_back(worker);
+    for (auto &th : threads) th.join();
+    return s2;
+}
+
+// Counts the primes in [lo, hi] into 'total' and, for each sorted query
+// q in [lo, hi], the primes in [lo, q] into queryCounts. Needs lo > 2.
+void countPrimesWithQueries(long lo, long hi, const std::vector<long> &basePrimes,
+                            const long* queries, long numQueries,
+                            long* queryCounts, long &total) {
+    const long segmentBytes = sieveSegmentBytes(lo, hi, 2);
+    const long segmentSpan = 2 * segmentBytes;
+    std::vector<char> segment(segmentBytes);
+
+    long running = 0;
+    long qi = 0;
+    for (long low = lo | 1; low <= hi; low += segmentSpan) {
+        long high = std::min(low + segmentSpan - 1, hi);
+        long count = (high - low) / 2 + 1;
+        std::fill(segment.begin(), segment.begin() + count, 1);
+
+        for (size_t k = 1; k < basePrimes.size(); ++k) {
+            long p = basePrimes[k];
+            if (p * p > high) break;
+            long first = std::max(p * p, ((low + p - 1) / p) * p);
+            if (first % 2 == 0) first += p;
+            for (long m = first; m <= high; m += 2 * p) segment[(m - low) / 2] = 0;
+        }
+
+        long i = 0;
+        for (; qi < numQueries && queries[qi] <= high; ++qi) {
+            if (queries[qi] >= low) {
+                for (long upto = (queries[qi] - low) / 2; i <= upto; ++i) running += segment[i];
+            }
+            queryCounts[qi] = running;
+        }
+        for (; i < count; ++i) running += segment[i];
+    }
+    for (; qi < numQueries; ++qi) queryCounts[qi] = running;
+    total = running;
+}
+
+// P2(x, a) = sum over primes y < p <= sqrt(x) of pi(x / p) - pi(p) + 1.
+long lmoP2(long x, long y, long numThreads) {
+    const long sqrtX = integerSqrt(x);
+    const long limit = x / y;
+    std::vector<long> primes = basePrimesUpTo(sqrtX);
+    const long piY = std::upper_bound(primes.begin(), primes.end(), y) - primes.begin();
+    const long piSqrtX = static_cast<long>(primes.size());
+    if (piY >= piSqrtX) return 0;
+
+    // x / p for p from sqrt(x) down to y: increasing, all in [sqrt(x), x / y].
+    std::vector<long> queries;
+    for (long b = piSqrtX - 1; b >= piY; --b) queries.push_back(x / primes[b]);
+
+    // (sqrt(x), x / y] is cut into one contiguous chunk per thread.
+    std::vector<long> queryCounts(queries.size());
+    std::vector<long> chunkTotals(numThreads, 0);
+    std::vector<long> chunkFirstQuery(numThreads + 1);
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    const long span = limit - sqrtX;
+    for (long i = 0; i < numThreads; ++i) {
+        long lo = sqrtX + 1 + span * i / numThreads;
+        long hi = sqrtX + span * (i + 1) / numThreads;
+        chunkFirstQuery[i] = std::lower_bound(queries.begin(), queries.end(), lo) - queries.begin();
+        chunkFirstQuery[i + 1] = std::upper_bound(queries.begin(), queries.end(), hi) - queries.begin();
+        if (i == 0) chunkFirstQuery[0] = 0;   // x / p == sqrt(x) sits below the first chunk
+        threads.emplace_back(countPrimesWithQueries, lo, hi, std::cref(primes),
+                             queries.data() + chunkFirstQuery[i],
+                             chunkFirstQuery[i + 1] - chunkFirstQuery[i],
+                             queryCounts.data() + chunkFirstQuery[i],
+                             std::ref(chunkTotals[i]));
+    }
+    for (auto &th : threads) th.join();
+
+    long p2 = 0;
+    long before = piSqrtX;   // pi(sqrt(x))
+    for (long i = 0; i < numThreads; ++i) {
+        for (long q = chunkFirstQuery[i]; q < chunkFirstQuery[i + 1]; ++q) {
+            long b = piSqrtX - 1 - q;   // 0-based index of the prime behind query q
+            p2 += before + queryCounts[q] - b;
+        }
+        before += chunkTotals[i];
+    }
+    return p2;
+}
+
+// Milliseconds spent in each LMO phase, summed over the calls of one run.
+struct LmoTimings {
+    double s1Ms = 0;
+    double s2Ms = 0;
+    double p2Ms = 0;
+};
+
+static LmoTimings g_lmoTimings;
+
+double millisSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// pi(x).
+long lmoPrimeCount(long x, long numThreads) {
+    if (x < kLmoDirectLimit) {
+        return static_cast<long>(basePrimesUpTo(x).size());
+    }
+
+    const long cbrtX = integerCbrt(x);
+    // Larger y shrinks the sieve of [1, x / y) but adds special leaves;
+    // measured best around alpha = 2 at 10^12 and slowly growing after that.
+    const double alpha = std::max(1.0, std::log(static_cast<double>(x)) / 12.0);
+    const long y = std::min(static_cast<long>(alpha * cbrtX), integerSqrt(x));
+
+    LmoTables tables(y);
+    const long piY = tables.piY();
+    PhiTiny phiTiny(std::min(6L, piY));
+    const long c = phiTiny.c();
+
+    auto start = std::chrono::steady_clock::now();
+    long s1 = 0;
+    for (long n = 1; n <= y; ++n) {
+        if (tables.mu[n] != 0 && tables.lpf[n] > tables.primes[c]) {
+            s1 += tables.mu[n] * phiTiny(x / n);
+        }
+    }
+    g_lmoTimings.s1Ms += millisSince(start);
+
+    start = std::chrono::steady_clock::now();
+    long s2 = lmoS2(x, y, tables, c, numThreads);
+    g_lmoTimings.s2Ms += millisSince(start);
+
+    start = std::chrono::steady_clock::now();
+    long p2 = lmoP2(x, y, numThreads);
+    g_lmoTimings.p2Ms += millisSince(start);
+
+    return s1 + s2 + piY - 1 - p2;
+}
+
+void runSchemeL(long minNumber, long maxNumber, long numThreads) {
+    g_lmoTimings = LmoTimings();
+    g_primeCount = lmoPrimeCount(maxNumber, numThreads);
+    if (minNumber > 1) {
+        g_primeCount -= lmoPrimeCount(minNumber - 1, numThreads);
+    }
+    std::cout << std::fixed << std::setprecision(1)
+              << "LMO phases: S1 " << g_lmoTimings.s1Ms << " ms, S2 " << g_lmoTimings.s2Ms
+              << " ms, P2 " << g_lmoTimings.p2Ms << " ms\n";
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+// ============================================================================
+// SCHEME N: n-th Prime
+//
+// Instead of listing every prime up to p_n, the n-th prime is located in
+// three phases:
+//   1. estimate: x0 = li^-1(n), the inverse logarithmic integral, which is
+//      off by roughly sqrt(x0) / log(x0) primes;
+//   2. count: pi(x0) with the LMO counter of Scheme L;
+//   3. sieve: only the window between x0 and p_n, a few gaps times the
+//      estimate's error wide, cut into ranges for Scheme A's work-stealing
+//      threads. Each range is sieved into its own buffer.
+// ============================================================================
+
+// li(x) by Ramanujan's series.
+long double logIntegral(long double x) {
+    const long double eulerGamma = 0.577215664901532860606512090082L;
+    const long double logX = std::log(x);
+    long double sum = 0;
+    long double term = 1;        // (log x)^n / (n! 2^(n-1)), sign included
+    long double inner = 0;       // sum of 1 / (2k + 1) for k <= (n - 1) / 2
+    for (int n = 1; n < 200; ++n) {
+        term *= (n == 1 ? logX : -logX / (2.0L * n));
+        if ((n - 1) % 2 == 0) inner += 1.0L / n;
+        long double add = term * inner;
+        sum += add;
+        if (std::fabs(add) < 1e-18L * std::fabs(sum)) break;
+    }
+    return eulerGamma + std::log(logX) + std::sqrt(x) * sum;
+}
+
+// x with li(x) = n, by Newton's method (li'(x) = 1 / log x).
+// pi(2^63 - 1): the n-th prime fits in a long only for n up to this.
+static const long kPrimeCountLongMax = 216289611853439384L;
+
+long inverseLogIntegral(long n) {
+    if (n < 2) return 2;
+    long double x = n * std::log(static_cast<long double>(n)) + 2;
+    for (int i = 0; i < 100; ++i) {
+        long double step = (logIntegral(x) - n) * std::log(x);
+        x -= step;
+        if (x < 2) x = 2;
+        if (std::fabs(step) < 0.5L) break;
+    }
+    // Near kPrimeCountLongMax the estimate may pass 2^63 - 1, where the
+    // conversion would be undefined.
+    const long double top = static_cast<long double>(std::numeric_limits<long>::max());
+    return x >= top ? std::numeric_limits<long>::max() : static_cast<long>(x);
+}
+
+// Appends the primes in [lo, hi] to 'out' in increasing order; basePrimes
+// must reach sqrt(hi).
+void appendPrimesInRange(long lo, long hi, const std::vector<long> &basePrimes,
+                         std::vector<long> &out) {
+    if (lo <= 2 && hi >= 2) out.push_back(2);
+    const long segmentSpan = 2 * kSieveSegmentBytes;
+    std::vector<char> segment(kSieveSegmentBytes);
+    for (long low = std::max(3L, lo | 1); low <= hi; low += segmentSpan) {
+        long high = std::min(low + segmentSpan - 1, hi);
+        long count = (high - low) / 2 + 1;
+        std::fill(segment.begin(), segment.begin() + count, 1);
+        for (size_t k = 1; k < basePrimes.size(); ++k) {
+            long p = basePrimes[k];
+            if (p * p > high) break;
+            long first = std::max(p * p, ((low + p - 1) / p) * p);
+            if (first % 2 == 0) first += p;
+            for (long m = first; m <= high; m += 2 * p) segment[(m - low) / 2] = 0;
+        }
+        for (long i = 0; i < count; ++i) {
+            if (segment[i]) out.push_back(low + 2 * i);
+        }
+    }
+}
+
+// Primes in [lo, hi], sieved by 'numThreads' Scheme A style workers.
+std::vector<long> primesInWindow(long lo, long hi, long numThreads) {
+    std::vector<long> basePrimes = basePrimesUpTo(integerSqrt(hi));
+    long rangeSize = std::max(2 * kSieveSegmentBytes, (hi - lo + 1) / (8 * numThreads) + 1);
+    WorkStealingScheduler scheduler(numThreads, lo, hi, rangeSize);
+    std::vector<RangeRuns> runs(numThreads);
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (long i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&, i]() {
+            WorkRange range;
+            bool stolen;
+            while (scheduler.next(i, range, stolen)) {
+                appendPrimesInRange(range.start, range.end, basePrimes, runs[i].collect(range));
+            }
+        });
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    std::vector<long> primes;
+    RangeRuns::merge(runs, primes);
+    return primes;
+}
+
+// Phase timings of the last nthPrime() call.
+struct NthPrimeTimings {
+    double estimateMs = 0;
+    double countMs = 0;
+    double sieveMs = 0;
+    long estimate = 0;
+    long countAtEstimate = 0;
+    long windows = 0;
+};
+
+long nthPrime(long n, long numThreads, NthPrimeTimings &timings) {
+    auto start = std::chrono::steady_clock::now();
+    long x = inverseLogIntegral(n);
+    timings.estimateMs = millisSince(start);
+    timings.estimate = x;
+
+    start = std::chrono::steady_clock::now();
+    long count = lmoPrimeCount(x, numThreads);   // primes <= x
+    timings.countMs = millisSince(start);
+    timings.countAtEstimate = count;
+
+    // Walk windows away from x until the n-th prime is inside one. Each
+    // window is sized for the remaining distance, at about 2 log x per prime.
+    start = std::chrono::steady_clock::now();
+    const double logX = std::log(static_cast<double>(std::max(x, 3L)));
+    long result = 0;
+    while (result == 0) {
+        ++timings.windows;
+        long missing = count >= n ? count - n + 1 : n - count;
+        long width = std::max(4 * kSieveSegmentBytes, static_cast<long>(2.0 * missing * logX));
+        if (count >= n) {
+            // p_n <= x: it is the missing-th prime counting down from x.
+            long lo = std::max(2L, x - width + 1);
+            std::vector<long> primes = primesInWindow(lo, x, numThreads);
+            if (static_cast<long>(primes.size()) >= missing) {
+                result = primes[primes.size() - missing];
+            } else {
+                count -= static_cast<long>(primes.size());
+                x = lo - 1;
+            }
+        } else {
+            // p_n > x: it is the missing-th prime after x.
+            long hi = width > std::numeric_limits<long>::max() - x ? std::numeric_limits<long>::max()
+                                                                    : x + width;
+            std::vector<long> primes = primesInWindow(x + 1, hi, numThreads);
+            if (static_cast<long>(primes.size()) >= missing) {
+                result = primes[missing - 1];
+            } else {
+                count += static_cast<long>(primes.size());
+                x = hi;
+            }
+        }
+    }
+    timings.sieveMs = millisSince(start);
+    return result;
+}
+
+// ============================================================================
+// BINARY PRIME FILES
+//
+// Text output costs ~11 bytes per prime near 10^10. With 'output=binary' the
+// print-after modes write the primes to 'outputFile' instead, as gaps:
+//
+//   offset  size  field
+//        0     8  magic "PRIMEGAP"
+//        8     4  version (1)
+//       12     4  reserved (0)
+//       16     8  range low   (inclusive)
+//       24     8  range high  (inclusive)
+//       32     8  prime count
+//       40     8  FNV-1a 64 checksum of the payload bytes
+//       48     -  payload
+//
+// All integers are little-endian. The payload holds one LEB128 varint per
+// prime: the first prime itself, then the half-gap (gap / 2) to the
+// previous one. Gaps between odd primes are even and below 256 up to ~4e8,
+// so nearly every prime takes a single byte. The only odd gap, 2 -> 3, is
+// stored as half-gap 0, which cannot occur anywhere else.
+//
+// './main decode <file>' checks a file and prints its primes as text.
+// ============================================================================
+static const char kPrimeFileMagic[8] = { 'P', 'R', 'I', 'M', 'E', 'G', 'A', 'P' };
+static const uint32_t kPrimeFileVersion = 1;
+static const size_t kPrimeFileHeaderSize = 48;
+
+struct PrimeFileHeader {
+    uint64_t rangeLow;
+    uint64_t rangeHigh;
+    uint64_t count;
+    uint64_t checksum;
+};
+
+static const uint64_t kFnvOffset = 1469598103934665603ULL;
+static const uint64_t kFnvPrime = 1099511628211ULL;
+
+// Writes 'primes' (sorted, all within [rangeLow, rangeHigh]) to 'path'.
+// Returns false and reports on std::cerr if the file cannot be written.
+bool writePrimeFile(const std::string &path, long rangeLow, long rangeHigh,
+                    const std::vector<long> &primes, uint64_t &bytesWritten) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Could not open output file: " << path << std::endl;
+        return false;
+    }
+
+    // The checksum is only known at the end; write a placeholder first.
+    unsigned char header[kPrimeFileHeaderSize] = {};
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    std::vector<unsigned char> buffer;
+    buffer.reserve(1 << 20);
+    uint64_t checksum = kFnvOffset;
+    uint64_t payloadBytes = 0;
+    long prev = 0;
+
+    auto flushBuffer = [&] {
+        for (unsigned char b : buffer) checksum = (checksum ^ b) * kFnvPrime;
+        out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+        payloadBytes += buffer.size();
+        buffer.clear();
+    };
+
+    for (size_t i = 0; i < primes.size(); ++i) {
+        uint64_t v = (i == 0) ? static_cast<uint64_t>(primes[0])
+                              : static_cast<uint64_t>(primes[i] - prev) >> 1;
+        prev = primes[i];
+        while (v >= 0x80) {
+            buffer.push_back(static_cast<unsigned char>(v | 0x80));
+            v >>= 7;
+        }
+        buffer.push_back(static_cast<unsigned char>(v));
+        if (buffer.size() >= (1 << 20) - 16) flushBuffer();
+    }
+    flushBuffer();
+
+    std::memcpy(header, kPrimeFileMagic, sizeof(kPrimeFileMagic));
+    putU32LE(header + 8, kPrimeFileVersion);
+    putU32LE(header + 12, 0);
+    putU64LE(header + 16, static_cast<uint64_t>(rangeLow));
+    putU64LE(header + 24, static_cast<uint64_t>(rangeHigh));
+    putU64LE(header + 32, primes.size());
+    putU64LE(header + 40, checksum);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    if (!out) {
+        std::cerr << "Error while writing output file: " << path << std::endl;
+        return false;
+    }
+    bytesWritten = kPrimeFileHeaderSize + payloadBytes;
+    return true;
+}
+
+// Reads and validates a file written by writePrimeFile. Returns false and
+// reports on std::cerr if the file is missing, truncated or corrupt. The
+// checksum covers only the payload, so the header is checked against it:
+// every prime must lie in [rangeLow, rangeHigh], in increasing order, and
+// there must be exactly 'count' of them.
+bool readPrimeFile(const std::string &path, PrimeFileHeader &header, std::vector<long> &primes) {
+    struct stat st;
+    std::ifstream in(path, std::ios::binary);
+    if (!in || ::stat(path.c_str(), &st) != 0) {
+        std::cerr << "Could not open prime file: " << path << std::endl;
+        return false;
+    }
+    if (!S_ISREG(st.st_mode)) {   // a directory opens, but has no sensible size
+        std::cerr << "Not a regular file: " << path << std::endl;
+        return false;
+    }
+    in.seekg(0, std::ios::end);
+    const std::streamoff size = in.tellg();
+    if (!in || size < 0) {
+        std::cerr << "Could not read prime file: " << path << std::endl;
+        return false;
+    }
+    std::vector<unsigned char> data(static_cast<size_t>(size));
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(data.data()), data.size())) {
+        std::cerr << "Could not read prime file: " << path << std::endl;
+        return false;
+    }
+
+    if (data.size() < kPrimeFileHeaderSize ||
+        std::memcmp(data.data(), kPrimeFileMagic, sizeof(kPrimeFileMagic)) != 0) {
+        std::cerr << "Not a prime file: " << path << std::endl;
+        return false;
+    }
+    uint32_t version = static_cast<uint32_t>(getU64LE(data.data() + 8) & 0xFFFFFFFFu);
+    if (version != kPrimeFileVersion) {
+        std::cerr << "Unsupported prime file version " << version << ": " << path << std::endl;
+        return false;
+    }
+    header.rangeLow = getU64LE(data.data() + 16);
+    header.rangeHigh = getU64LE(data.data() + 24);
+    header.count = getU64LE(data.data() + 32);
+    header.checksum = getU64LE(data.data() + 40);
+    if (header.rangeLow > header.rangeHigh ||
+        header.rangeHigh > static_cast<uint64_t>(std::numeric_limits<long>::max())) {
+        std::cerr << "Invalid range [" << header.rangeLow << ".." << header.rangeHigh
+                  << "] in prime file: " << path << std::endl;
+        return false;
+    }
+
+    uint64_t checksum = kFnvOffset;
+    for (size_t i = kPrimeFileHeaderSize; i < data.size(); ++i) {
+        checksum = (checksum ^ data[i]) * kFnvPrime;
+    }
+    if (checksum != header.checksum) {
+        std::cerr << "Checksum mismatch in prime file: " << path << std::endl;
+        return false;
+    }
+
+    // Every prime takes at least one byte, so a corrupt count cannot make
+    // this reserve more than the payload.
+    primes.clear();
+    primes.reserve(std::min<uint64_t>(header.count, data.size() - kPrimeFileHeaderSize));
+    uint64_t prev = 0;
+    size_t pos = kPrimeFileHeaderSize;
+    while (pos < data.size()) {
+        uint64_t v = 0;
+        int shift = 0;
+        for (;;) {
+            if (pos >= data.size() || shift > 63) {
+                std::cerr << "Truncated varint in prime file: " << path << std::endl;
+                return false;
+            }
+            unsigned char b = data[pos++];
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            shift += 7;
+            if (!(b & 0x80)) break;
+        }
+
+        uint64_t next;
+        if (primes.empty()) {
+            next = v;
+        } else if (v > (header.rangeHigh - prev) / 2) {
+            next = header.rangeHigh + 1;               // past the range, without overflowing
+        } else if (prev == 2) {
+            next = 3 + 2 * v;                          // half-gap 0 encodes 2 -> 3
+        } else {
+            next = prev + 2 * v;
+        }
+        if (next < header.rangeLow || next > header.rangeHigh) {
+            std::cerr << "Prime outside the range [" << header.rangeLow << ".." << header.rangeHigh
+                      << "] in prime file: " << path << std::endl;
+            return false;
+        }
+        if (!primes.empty() && next <= prev) {
+            std::cerr << "Primes out of order in prime file: " << path << std::endl;
+            return false;
+        }
+        prev = next;
+        primes.push_back(static_cast<long>(next));
+    }
+
+    if (primes.size() != header.count) {
+        std::cerr << "Prime file holds " << primes.size() << " primes, header says "
+                  << header.count << ": " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int runDecode(const std::string &path) {
+    PrimeFileHeader header;
+    std::vector<long> primes;
+    if (!readPrimeFile(path, header, primes)) {
+        return 1;
+    }
+
+    std::cout << "Range: [" << header.rangeLow << ".." << header.rangeHigh << "], "
+              << header.count << " primes, checksum OK\n";
+    std::cout << "\n=== Primes found:\n";
+    for (long p : primes) {
+        std::cout << p << " ";
+    }
+    std::cout << std::endl;
+    return 0;
+}
+
+// ============================================================================
+// MICROBENCHMARKS
+//
+// Standalone timings of the hot kernels, selected from the menu or with
+// 'scheme=M'. They do not touch maxNumber or the thread count.
+// ============================================================================
+template <typename Fn>
+double nanosPerCall(const std::vector<long> &inputs, Fn fn, long &sink) {
+    auto start = std::chrono::steady_clock::now();
+    for (long n : inputs) {
+        sink += fn(n);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / inputs.size();
+}
+
+void benchmarkMulMod() {
+    std::mt19937_64 rng(12345);
+    const size_t kInputs = 200000;
+
+    std::vector<long> randomOdd, primes;
+    randomOdd.reserve(kInputs);
+    while (randomOdd.size() < kInputs) {
+        randomOdd.push_back(static_cast<long>((rng() >> 1) | 1));
+    }
+    while (primes.size() < kInputs / 10) {
+        long n = static_cast<long>((rng() >> 1) | 1);
+        if (isPrimeMontgomery(n)) primes.push_back(n);
+    }
+
+    std::cout << "\n=== Strong probable-prime test: __int128 % vs Montgomery\n"
+              << std::left << std::setw(22) << "  input set"
+              << std::right << std::setw(16) << "int128 ns/test"
+              << std::setw(20) << "Montgomery ns/test"
+              << std::setw(10) << "speedup" << "\n";
+
+    long sink = 0;
+    const std::vector<long>* sets[] = { &randomOdd, &primes };
+    const char* names[] = { "  random odd 63-bit", "  63-bit primes" };
+    for (int i = 0; i < 2; ++i) {
+        double naive = nanosPerCall(*sets[i], isPrimeMillerRabin, sink);
+        double mont = nanosPerCall(*sets[i], isPrimeMontgomery, sink);
+        std::cout << std::left << std::setw(22) << names[i] << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(16) << naive
+                  << std::setw(20) << mont
+                  << std::setw(9) << naive / mont << "x\n";
+    }
+
+    // Raw kernel: a dependent chain of squarings, reported per multiply.
+    const int kChain = 64;
+    double naive = nanosPerCall(primes, [](long n) {
+        uint64_t m = static_cast<uint64_t>(n), x = 3;
+        for (int i = 0; i < kChain; ++i) x = mulMod64(x, x, m);
+        return static_cast<long>(x & 1);
+    }, sink) / kChain;
+    double mont = nanosPerCall(primes, [](long n) {
+        Montgomery64 m(static_cast<uint64_t>(n));
+        uint64_t x = m.toMontgomery(3);
+        for (int i = 0; i < kChain; ++i) x = m.mul(x, x);
+        return static_cast<long>(x & 1);
+    }, sink) / kChain;
+    std::cout << std::left << std::setw(22) << "  one mulmod, ns/op" << std::right
+              << std::setw(16) << naive
+              << std::setw(20) << mont
+              << std::setw(9) << naive / mont << "x\n";
+
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6) << "  (checksum " << sink << ")\n";
+}
+
+// 7-base Miller-Rabin vs Baillie-PSW, both in Montgomery form. The third
+// set has no factor below 100, like candidates that were already sieved.
+void benchmarkBailliePSW() {
+    std::mt19937_64 rng(54321);
+    const size_t kInputs = 200000;
+
+    std::vector<long> randomOdd, sieved, primes;
+    randomOdd.reserve(kInputs);
+    while (randomOdd.size() < kInputs) {
+        randomOdd.push_back(static_cast<long>((rng() >> 1) | 1));
+    }
+    while (sieved.size() < kInputs) {
+        long n = static_cast<long>((rng() >> 1) | 1);
+        bool smallFactor = false;
+        for (long p = 3; p < 100 && !smallFactor; p += 2) smallFactor = n % p == 0;
+        if (!smallFactor) sieved.push_back(n);
+    }
+    while (primes.size() < kInputs / 10) {
+        long n = static_cast<long>((rng() >> 1) | 1);
+        if (isPrimeMontgomery(n)) primes.push_back(n);
+    }
+
+    std::cout << "\n=== 64-bit primality: 7-base Miller-Rabin vs Baillie-PSW\n"
+              << std::left << std::setw(22) << "  input set"
+              << std::right << std::setw(16) << "MR ns/test"
+              << std::setw(20) << "BPSW ns/test"
+              << std::setw(10) << "speedup" << "\n";
+
+    long sink = 0;
+    const std::vector<long>* sets[] = { &randomOdd, &sieved, &primes };
+    const char* names[] = { "  random odd 63-bit", "  no factor < 100", "  63-bit primes" };
+    for (int i = 0; i < 3; ++i) {
+        double mr = nanosPerCall(*sets[i], isPrimeMontgomery, sink);
+        double bpsw = nanosPerCall(*sets[i], isPrimeBailliePSW, sink);
+        std::cout << std::left << std::setw(22) << names[i] << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(16) << mr
+                  << std::setw(20) << bpsw
+                  << std::setw(9) << mr / bpsw << "x\n";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6) << "  (checksum " << sink << ")\n";
+}
+
+// Scheme B's early-exit check: mutex on every divisor vs. an atomic flag
+// polled every g_cancelPollInterval divisors. n is prime, so nobody exits
+// early and every check is paid for.
+void benchmarkCancelFlag() {
+    const long n = 999999999989L;
+    const long limit = integerSqrt(n);
+    const int kRepeats = 5;
+
+    std::cout << "\n=== Scheme B early-exit flag: mutex per divisor vs atomic polled every "
+              << g_cancelPollInterval << "\n"
+              << std::setw(10) << "threads"
+              << std::setw(14) << "mutex ms"
+              << std::setw(14) << "atomic ms"
+              << std::setw(10) << "speedup" << "\n";
+
+    for (long numThreads : { 8L, 16L, 32L }) {
+        std::vector<DivRange> ranges;
+        long chunk = (limit - 2) / numThreads;
+        for (long t = 0; t < numThreads; ++t) {
+            long start = 3 + t * chunk;
+            long end = (t == numThreads - 1) ? limit : start + chunk - 1;
+            ranges.push_back({ start, end });
+        }
+
+        auto lockedStart = std::chrono::steady_clock::now();
+        for (int rep = 0; rep < kRepeats; ++rep) {
+            bool compositeFound = false;
+            std::mutex flagMutex;
+            std::vector<std::thread> threads;
+            for (const DivRange &r : ranges) {
+                threads.emplace_back(workerCheckDivRangeLocked, n, r.startDiv, r.endDiv,
+                                     std::ref(compositeFound), std::ref(flagMutex));
+            }
+            for (auto &th : threads) th.join();
+        }
+        auto lockedEnd = std::chrono::steady_clock::now();
+
+        for (int rep = 0; rep < kRepeats; ++rep) {
+            CancelFlag compositeFound;
+            std::vector<std::thread> threads;
+            for (const DivRange &r : ranges) {
+                threads.emplace_back(workerCheckDivRange, n, r.startDiv, r.endDiv,
+                                     std::ref(compositeFound));
+            }
+            for (auto &th : threads) th.join();
+        }
+        auto atomicEnd = std::chrono::steady_clock::now();
+
+        double lockedMs = std::chrono::duration<double, std::milli>(lockedEnd - lockedStart).count() / kRepeats;
+        double atomicMs = std::chrono::duration<double, std::milli>(atomicEnd - lockedEnd).count() / kRepeats;
+        std::cout << std::fixed << std::setprecision(2)
+                  << std::setw(10) << numThreads
+                  << std::setw(14) << lockedMs
+                  << std::setw(14) << atomicMs
+                  << std::setw(9) << lockedMs / atomicMs << "x\n";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+}
+
+// One timestamp as printed per prime: the original
+// system_clock + localtime + strftime path vs. the cached formatter, with
+// system_clock or (when available) the calibrated TSC as the clock.
+void benchmarkTimestamps() {
+    const int kIterations = 2000000;
+    char buffer[32];
+    long sink = 0;
+
+    auto timeIt = [&](const std::function<void()> &fn) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kIterations; ++i) fn();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / kIterations;
+    };
+
+    double original = timeIt([&] {
+        auto now = std::chrono::system_clock::now();
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
+        std::time_t now_c = std::chrono::system_clock::to_time_t(now);
+        std::tm* now_tm = std::localtime(&now_c);
+        size_t len = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", now_tm);
+        std::snprintf(buffer + len, sizeof(buffer) - len, ".%03d", static_cast<int>(ms.count()));
+        sink += buffer[len + 3];
+    });
+
+    TimestampFormatter formatter;
+    double cached = timeIt([&] {
+        sink += buffer[formatter.format(systemNowNs(), buffer) - 1];
+    });
+
+    TscClock tsc;
+    bool haveTsc = tsc.calibrate();
+    double tscCached = haveTsc ? timeIt([&] {
+        sink += buffer[formatter.format(tsc.nowNs(), buffer) - 1];
+    }) : 0;
+
+    std::cout << "\n=== Timestamp cost per printed prime\n"
+              << std::setfill(' ') << std::fixed << std::setprecision(1)
+              << "  system_clock + localtime + strftime   " << std::setw(8) << original << " ns\n"
+              << "  system_clock + cached formatter       " << std::setw(8) << cached << " ns\n";
+    if (haveTsc) {
+        std::cout << "  TSC clock + cached formatter          " << std::setw(8) << tscCached << " ns\n";
+    } else {
+        std::cout << "  TSC clock + cached formatter          (no invariant TSC)\n";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6) << "  (checksum " << sink << ")\n";
+}
+
+// Scheme A per-range cost: isPrime() on every number vs. starting from the
+// pre-sieved tile, on 'kBlocks' consecutive ranges of g_chunkSize numbers.
+void benchmarkPresieve() {
+    const long kBlocks = 200;
+    std::cout << "\n=== Scheme A range of " << g_chunkSize << " numbers: every number vs pre-sieved tile\n"
+              << std::setw(12) << "start"
+              << std::setw(18) << "plain us/range"
+              << std::setw(18) << "tiled us/range"
+              << std::setw(10) << "speedup" << "\n";
+
+    presieveTile();   // build the tables outside the timing
+    presieveSievePrimes();
+    std::vector<uint8_t> block;
+    long sink = 0;
+    for (long base : { 100000L, 1000000000L, 4000000000L, 1000000000000000L }) {
+        auto plainStart = std::chrono::steady_clock::now();
+        for (long b = 0; b < kBlocks; ++b) {
+            long start = base + b * g_chunkSize;
+            for (long n = start; n < start + g_chunkSize; ++n) sink += isPrime(n);
+        }
+        auto plainEnd = std::chrono::steady_clock::now();
+        for (long b = 0; b < kBlocks; ++b) {
+            long start = base + b * g_chunkSize;
+            forEachPresievedPrime(start, start + g_chunkSize - 1, block, [&](long) { ++sink; });
+        }
+        auto tiledEnd = std::chrono::steady_clock::now();
+
+        double plainUs = std::chrono::duration<double, std::micro>(plainEnd - plainStart).count() / kBlocks;
+        double tiledUs = std::chrono::duration<double, std::micro>(tiledEnd - plainEnd).count() / kBlocks;
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(12) << base
+                  << std::setw(18) << plainUs
+                  << std::setw(18) << tiledUs
+                  << std::setw(9) << plainUs / tiledUs << "x\n";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6) << "  (checksum " << sink << ")\n";
+}
+
+void runMicrobenchmarks() {
+    benchmarkMulMod();
+    benchmarkBailliePSW();
+    benchmarkCancelFlag();
+    benchmarkTimestamps();
+    benchmarkPresieve();
+}
+
+struct MenuEntry {
+    const char* label;
+    Scheme scheme;
+    bool printImmediately;
+};
+
+static const MenuEntry kMenu[] = {
+    { "Scheme A (range partition) + immediate printing",               SCHEME_A, true  },
+    { "Scheme A (range partition) + print after",                      SCHEME_A, false },
+    { "Scheme B (divisor-splitting, up to sqrt) + immediate printing", SCHEME_B, true  },
+    { "Scheme B (divisor-splitting, up to sqrt) + print after",        SCHEME_B, false },
+    { "Scheme C (batched divisor-splitting) + immediate printing",     SCHEME_C, true  },
+    { "Scheme C (batched divisor-splitting) + print after",            SCHEME_C, false },
+    { "Scheme S (segmented sieve) + immediate printing",               SCHEME_S, true  },
+    { "Scheme S (segmented sieve) + print after",                      SCHEME_S, false },
+    { "Scheme W (wheel-30 bit sieve) + immediate printing",            SCHEME_W, true  },
+    { "Scheme W (wheel-30 bit sieve) + print after",                   SCHEME_W, false },
+    { "Scheme K (bucket sieve, large ranges) + immediate printing",    SCHEME_K, true  },
+    { "Scheme K (bucket sieve, large ranges) + print after",           SCHEME_K, false },
+    { "Scheme L (LMO prime counting) + count only",                    SCHEME_L, false },
+    { "Find the n-th prime",                                           SCHEME_N, false },
+    { "Check a single number for primality",                           SCHEME_Q, false },
+    { "Run microbenchmarks",                                           SCHEME_M, false },
+};
+static const int kMenuSize = static_cast<int>(sizeof(kMenu) / sizeof(kMenu[0]));
+
+// ----------------------------------------------------------------------------
+// Command line and batch jobs.
+//
+// Every config.txt key can also be given as a flag, '--key=value' or
+// '--key value', and overrides the file; --min and --max are short for
+// minNumber and maxNumber. A batch file holds one job per line, written as
+// the same flags and applied on top of the base configuration, so a whole
+// scaling sweep runs in one process and ends with a timing table.
+// ----------------------------------------------------------------------------
+void printUsage(const char* program, std::ostream &out = std::cerr) {
+    out << "Usage: " << program << " [--config=FILE] [--scheme=X] [--mode=immediate|after|count]\n"
+        << "       " << std::string(std::strlen(program), ' ')
+        << " [--threads=N] [--min=N] [--max=N] [--key=value ...]\n"
+        << "       " << program << " --batch=FILE [--config=FILE] [--key=value ...]\n"
+        << "       " << program << " bench [--schemes=A,B] [--threads=1,2,4] [--max=N,N] [--repeat=5]\n"
+        << "       " << program << " verify [--max=N] [--threads=N] [--top=true]\n"
+        << "       " << program << " decode <prime file>\n"
+        << "       " << program << " --help\n";
+}
+
+// Splits flags into 'key=value' settings. Returns false on a malformed flag.
+bool parseFlags(const std::vector<std::string> &args, std::vector<std::string> &settings) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string &arg = args[i];
+        if (arg.rfind("--", 0) != 0 || arg.size() == 2) {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            return false;
+        }
+        std::string key = arg.substr(2), value;
+        size_t eq = key.find('=');
+        if (eq != std::string::npos) {
+            value = key.substr(eq + 1);
+            key = key.substr(0, eq);
+        } else if (i + 1 < args.size()) {
+            value = args[++i];
+        } else {
+            std::cerr << "Missing value for " << arg << "\n";
+            return false;
+        }
+        if (key == "min") key = "minNumber";
+        if (key == "max") key = "maxNumber";
+        settings.push_back(key + "=" + value);
+    }
+    return true;
+}
+
+// Applies command-line settings to config; stops at the first unknown key or
+// bad value and returns why.
+ConfigLineResult applySettings(const std::vector<std::string> &settings, Config &config) {
+    for (const std::string &setting : settings) {
+        const ConfigLineResult result = applyConfigLine(setting, config);
+        if (result == CONFIG_UNKNOWN_KEY) {
+            std::cerr << "Unknown option: --" << setting.substr(0, setting.find('=')) << "\n";
+        }
+        if (result != CONFIG_APPLIED) return result;
+    }
+    return CONFIG_APPLIED;
+}
+
+const char* schemeName(Scheme scheme) {
+    static const char* names[] = { "A", "B", "C", "S", "W", "K", "L", "N", "Q", "M" };
+    return names[scheme];
+}
+
+void applyTuning(const Config &config) {
+    g_millerRabinCrossover = config.millerRabinCrossover;
+    g_forceTrialDivision = config.forceTrialDivision;
+    g_useMontgomery = config.useMontgomery;
+    g_useBailliePSW = config.useBailliePSW;
+    g_cancelPollInterval = config.cancelPollInterval;
+    g_batchSize = config.batchSize;
+    g_chunkSize = config.chunkSize;
+    g_presieve = config.presieve;
+    g_perfCounters = config.perfCounters;
+    g_stats = config.stats;
+}
+
+struct JobResult {
+    double elapsedMs = 0;
+    long primes = -1;   // unknown when they were only printed
+};
+
+// Runs one range scheme on [minNumber..maxNumber] with the usual report:
+// banners, primes (or their count or file), elapsed time, thread timings.
+// Returns false if the scheme is not a range scheme or output failed.
+bool runJob(const Config &config, Scheme scheme, bool printImmediately, bool countOnly,
+            JobResult &result) {
+    const long numThreads = config.threads;
+    const long minNumber = config.minNumber;
+    const long maxNumber = config.maxNumber;
+
+    applyTuning(config);
+    if (scheme == SCHEME_L) printImmediately = false;   // it only ever counts
+    g_countOnly = scheme == SCHEME_L || countOnly;
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::time_t startWallClock = std::time(nullptr);
+    std::cout << "\n=== Run started at ";
+    printCurrentTimestamp();
+    std::cout << "\n";
+
+    g_collectedPrimes.clear();
+    g_primeCount = 0;
+    unsigned long allocationsAtStart = g_heapAllocations.load();
+
+    // 4) Launch the selected scheme
+    g_threadTimings.clear();
+    g_threadPerf.assign(g_perfCounters ? numThreads : 0, PerfSample());
+    g_threadStats.clear();
+    if (printImmediately) {
+        startPrimeWriter();
+    }
+
+    if (scheme == SCHEME_A) {
+        // Scheme A
+        runSchemeA(minNumber, maxNumber, numThreads, printImmediately);
+    } else if (scheme == SCHEME_B) {
+        // Scheme B
+        runSchemeB(minNumber, maxNumber, numThreads, printImmediately);
+    } else if (scheme == SCHEME_C) {
+        // Scheme C
+        runSchemeC(minNumber, maxNumber, numThreads, printImmediately);
+    } else if (scheme == SCHEME_S) {
+        // Scheme S
+        runSchemeS(minNumber, maxNumber, numThreads, printImmediately);
+    } else if (scheme == SCHEME_W) {
+        // Scheme W
+        runSchemeW(minNumber, maxNumber, numThreads, printImmediately, config.cacheFile);
+    } else if (scheme == SCHEME_K) {
+        // Scheme K
+        runSchemeK(minNumber, maxNumber, numThreads, printImmediately);
+    } else if (scheme == SCHEME_L) {
+        // Scheme L
+        runSchemeL(minNumber, maxNumber, numThreads);
+    } else {
+        stopPrimeWriter();
+        std::cerr << "Invalid choice.\n";
+        return false;
+    }
+
+    stopPrimeWriter();
+    unsigned long runAllocations = g_heapAllocations.load() - allocationsAtStart;
+
+    // 5) If printing is to be done after (every scheme leaves the list sorted)
+    if (g_countOnly) {
+        result.primes = g_primeCount;
+        std::cout << "\n=== Primes in [" << minNumber << ".." << maxNumber << "]: "
+                  << g_primeCount << "\n";
+    } else if (!printImmediately && config.binaryOutput) {
+        result.primes = static_cast<long>(g_collectedPrimes.size());
+        uint64_t bytes = 0;
+        if (!writePrimeFile(config.outputFile, minNumber, maxNumber, g_collectedPrimes, bytes)) {
+            return false;
+        }
+        std::cout << "\n=== Wrote " << g_collectedPrimes.size() << " primes to "
+                  << config.outputFile << " (" << bytes << " bytes)\n";
+    } else if (!printImmediately) {
+        result.primes = static_cast<long>(g_collectedPrimes.size());
+        std::cout << "\n=== Primes found:\n";
+        for (long p : g_collectedPrimes) {
+            std::cout << p << " ";
+        }
+        std::cout << std::endl;
+    }
+
+    // 6) Print end time and total elapsed
+    auto endTime = std::chrono::steady_clock::now();
+    std::time_t endWallClock = std::time(nullptr);
+    std::cout << "\n=== Run ended at ";
+    printCurrentTimestamp();
+    std::cout << "\n";
+
+    result.elapsedMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
+    std::cout << "Total elapsed time: " << elapsed << " ms\n";
+
+    std::cout << "Heap allocations during run: " << runAllocations;
+    if (scheme == SCHEME_B) {
+        std::cout << " (" << std::fixed << std::setprecision(4)
+                  << static_cast<double>(runAllocations) / (maxNumber - std::max(2L, minNumber) + 1)
+                  << " per number tested)";
+        std::cout.unsetf(std::ios::floatfield);
+    }
+    std::cout << "\n";
+    if (!g_threadTimings.empty()) {
+        printThreadTimings();
+    }
+    printPerfCounters();
+    printThreadStats();
+    std::cout << "\n";
+
+    return true;
+}
+
+// Splits a batch line into arguments at whitespace.
+std::vector<std::string> splitArgs(const std::string &line) {
+    std::istringstream in(line);
+    std::vector<std::string> args;
+    std::string arg;
+    while (in >> arg) args.push_back(arg);
+    return args;
+}
+
+struct BatchRow {
+    Config config;
+    JobResult result;
+};
+
+void printBatchSummary(const std::vector<BatchRow> &rows) {
+    std::cout << "=== Batch summary\n"
+              << std::setfill(' ')
+              << std::setw(5) << "job"
+              << std::setw(8) << "scheme"
+              << std::setw(11) << "mode"
+              << std::setw(9) << "threads"
+              << std::setw(21) << "min"
+              << std::setw(21) << "max"
+              << std::setw(15) << "primes"
+              << std::setw(14) << "elapsed ms" << "\n";
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const Config &c = rows[i].config;
+        const char* mode = c.scheme == SCHEME_L || c.countOnly ? "count"
+                         : c.printImmediately ? "immediate" : "after";
+        std::cout << std::setw(5) << i + 1
+                  << std::setw(8) << schemeName(c.scheme)
+                  << std::setw(11) << mode
+                  << std::setw(9) << c.threads
+                  << std::setw(21) << c.minNumber
+                  << std::setw(21) << c.maxNumber;
+        if (rows[i].result.primes >= 0) {
+            std::cout << std::setw(15) << rows[i].result.primes;
+        } else {
+            std::cout << std::setw(15) << "-";
+        }
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(14) << rows[i].result.elapsedMs << "\n";
+        std::cout.unsetf(std::ios::floatfield);
+    }
+}
+
+// Runs one job per line of 'path'. A bad line stops the batch with its file
+// and line number; the jobs already run are still summarised.
+int runBatch(const std::string &path, const Config &base) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "Could not open batch file: " << path << std::endl;
+        return 1;
+    }
+
+    std::vector<BatchRow> rows;
+    auto fail = [&]() {
+        if (!rows.empty()) printBatchSummary(rows);
+        return 1;
+    };
+
+    std::string line;
+    long lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        std::vector<std::string> args = splitArgs(line);
+        if (args.empty() || args[0][0] == '#') continue;
+
+        BatchRow row;
+        row.config = base;
+        std::vector<std::string> settings;
+        if (!parseFlags(args, settings) || applySettings(settings, row.config) != CONFIG_APPLIED
+            || !validateConfig(row.config)) {
+            std::cerr << "  in " << path << " line " << lineNumber << std::endl;
+            return fail();
+        }
+        const Scheme scheme = row.config.scheme;
+        if (!row.config.schemeSet || scheme == SCHEME_N || scheme == SCHEME_Q || scheme == SCHEME_M) {
+            std::cerr << "Batch jobs need a range scheme (A, B, C, S, W, K or L): "
+                      << path << " line " << lineNumber << std::endl;
+            return fail();
+        }
+
+        std::cout << "=== Job " << rows.size() + 1 << ": " << line << "\n";
+        if (!runJob(row.config, scheme, row.config.printImmediately, row.config.countOnly, row.result)) {
+            std::cerr << "  in " << path << " line " << lineNumber << std::endl;
+            return fail();
+        }
+        rows.push_back(row);
+    }
+
+    printBatchSummary(rows);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// Scaling benchmark ('main bench').
+//
+// Runs each scheme in both print modes over a grid of thread counts and
+// maxNumber values, 'repeat' times per cell after one warm-up run. Standard
+// output goes to /dev/null for the duration of each run, so both the writer
+// thread and the print-after loop still do their full work. Speedup and
+// efficiency are relative to the smallest thread count in the grid.
+// ----------------------------------------------------------------------------
+struct BenchCell {
+    Scheme scheme;
+    bool printImmediately;
+    long threads;
+    long maxNumber;
+    std::vector<double> samplesMs;
+    double medianMs = 0, p95Ms = 0, speedup = 0, efficiency = 0;
+    long primes = -1;
+};
+
+// Points file descriptor 1 at /dev/null until destroyed.
+class StdoutSilencer {
+public:
+    StdoutSilencer() {
+        std::cout.flush();
+        std::fflush(stdout);
+        saved_ = ::dup(STDOUT_FILENO);
+        int null = ::open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            ::dup2(null, STDOUT_FILENO);
+            ::close(null);
+        }
+    }
+    ~StdoutSilencer() {
+        std::cout.flush();
+        std::fflush(stdout);
+        if (saved_ >= 0) {
+            ::dup2(saved_, STDOUT_FILENO);
+            ::close(saved_);
+        }
+    }
+
+private:
+    int saved_;
+};
+
+bool parseLongList(const std::string &value, std::vector<long> &out) {
+    out.clear();
+    std::istringstream in(value);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        try {
+            size_t used = 0;
+            long v = std::stol(item, &used);
+            if (used != item.size() || v <= 0) return false;
+            out.push_back(v);
+        } catch (...) {
+            return false;
+        }
+    }
+    return !out.empty();
+}
+
+bool parseSchemeList(const std::string &value, std::vector<Scheme> &out) {
+    out.clear();
+    std::istringstream in(value);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        Scheme scheme;
+        if (!parseScheme(item, scheme) || scheme == SCHEME_L || scheme == SCHEME_N
+            || scheme == SCHEME_Q || scheme == SCHEME_M) {
+            return false;
+        }
+        out.push_back(scheme);
+    }
+    return !out.empty();
+}
+
+// Median and nearest-rank 95th percentile of the samples.
+void summarizeSamples(BenchCell &cell) {
+    std::vector<double> sorted = cell.samplesMs;
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    cell.medianMs = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    size_t rank = static_cast<size_t>(std::ceil(0.95 * n));
+    cell.p95Ms = sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+void writeBenchCsv(std::ostream &out, const std::vector<BenchCell> &cells, long minNumber) {
+    out << "scheme,mode,threads,min,max,repeats,median_ms,p95_ms,speedup,efficiency,primes\n";
+    out << std::fixed;
+    for (const BenchCell &c : cells) {
+        out << schemeName(c.scheme) << ',' << (c.printImmediately ? "immediate" : "after") << ','
+            << c.threads << ',' << minNumber << ',' << c.maxNumber << ',' << c.samplesMs.size() << ','
+            << std::setprecision(3) << c.medianMs << ',' << c.p95Ms << ','
+            << std::setprecision(4) << c.speedup << ',' << c.efficiency << ',';
+        if (c.primes >= 0) out << c.primes;
+        out << '\n';
+    }
+}
+
+void writeBenchJson(std::ostream &out, const std::vector<BenchCell> &cells, long minNumber) {
+    out << "{\n  \"hardwareThreads\": " << std::thread::hardware_concurrency()
+        << ",\n  \"results\": [\n" << std::fixed;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        const BenchCell &c = cells[i];
+        out << "    {\"scheme\": \"" << schemeName(c.scheme) << "\", \"mode\": \""
+            << (c.printImmediately ? "immediate" : "after") << "\", \"threads\": " << c.threads
+            << ", \"min\": " << minNumber << ", \"max\": " << c.maxNumber
+            << std::setprecision(3) << ", \"medianMs\": " << c.medianMs << ", \"p95Ms\": " << c.p95Ms
+            << std::setprecision(4) << ", \"speedup\": " << c.speedup
+            << ", \"efficiency\": " << c.efficiency << ", \"primes\": ";
+        if (c.primes >= 0) out << c.primes; else out << "null";
+        out << std::setprecision(3) << ", \"samplesMs\": [";
+        for (size_t k = 0; k < c.samplesMs.size(); ++k) {
+            out << (k ? ", " : "") << c.samplesMs[k];
+        }
+        out << "]}" << (i + 1 < cells.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int runBench(const char* program, const std::vector<std::string> &args) {
+    std::vector<std::string> settings;
+    if (!parseFlags(args, settings)) {
+        std::cerr << "Usage: " << program << " bench [--schemes=A,B] [--threads=1,2,4] [--max=100000,1000000]\n"
+                  << "       [--repeat=5] [--csv=FILE] [--json=FILE] [--config=FILE] [--key=value ...]\n";
+        return 1;
+    }
+
+    std::vector<Scheme> schemes = { SCHEME_A, SCHEME_B };
+    std::vector<long> threadCounts, maxNumbers = { 100000, 1000000 };
+    for (long t = 1; t <= std::max(1L, static_cast<long>(std::thread::hardware_concurrency())); t *= 2) {
+        threadCounts.push_back(t);
+    }
+    long repeat = 5;
+    std::string csvPath = "bench.csv", jsonPath = "bench.json", configPath = "config.txt";
+    bool configRequired = false;
+    std::vector<std::string> overrides;
+
+    for (const std::string &setting : settings) {
+        size_t eq = setting.find('=');
+        std::string key = setting.substr(0, eq), value = setting.substr(eq + 1);
+        bool ok = true;
+        if (key == "schemes") {
+            ok = parseSchemeList(value, schemes);
+        } else if (key == "threads") {
+            ok = parseLongList(value, threadCounts);
+        } else if (key == "maxNumber") {
+            ok = parseLongList(value, maxNumbers);
+        } else if (key == "repeat") {
+            std::vector<long> r;
+            ok = parseLongList(value, r) && r.size() == 1;
+            if (ok) repeat = r[0];
+        } else if (key == "csv") {
+            csvPath = value;
+        } else if (key == "json") {
+            jsonPath = value;
+        } else if (key == "config") {
+            configPath = value;
+            configRequired = true;
+        } else {
+            overrides.push_back(setting);
+        }
+        if (!ok) {
+            std::cerr << "Invalid bench option: --" << setting << std::endl;
+            return 1;
+        }
+    }
+
+    Config base;
+    readConfig(configPath, base, configRequired);
+    if (applySettings(overrides, base) != CONFIG_APPLIED) return 1;
+    std::sort(threadCounts.begin(), threadCounts.end());
+
+    std::vector<BenchCell> cells;
+    for (Scheme scheme : schemes) {
+        for (bool printImmediately : { true, false }) {
+            for (long maxNumber : maxNumbers) {
+                for (long threads : threadCounts) {
+                    BenchCell cell;
+                    cell.scheme = scheme;
+                    cell.printImmediately = printImmediately;
+                    cell.threads = threads;
+                    cell.maxNumber = maxNumber;
+                    cells.push_back(cell);
+                }
+            }
+        }
+    }
+
+    std::cerr << "Benchmarking " << cells.size() << " cells x " << repeat << " runs...\n";
+    for (size_t i = 0; i < cells.size(); ++i) {
+        BenchCell &cell = cells[i];
+        Config config = base;
+        config.threads = cell.threads;
+        config.maxNumber = cell.maxNumber;
+        config.binaryOutput = false;
+        if (!validateConfig(config)) return 1;
+
+        for (long run = 0; run <= repeat; ++run) {
+            JobResult result;
+            bool ok;
+            {
+                StdoutSilencer silence;
+                ok = runJob(config, cell.scheme, cell.printImmediately, false, result);
+            }
+            if (!ok) return 1;
+            if (run > 0) cell.samplesMs.push_back(result.elapsedMs);   // run 0 warms up
+            cell.primes = result.primes;
+        }
+        summarizeSamples(cell);
+        std::cerr << "  [" << i + 1 << "/" << cells.size() << "] " << schemeName(cell.scheme)
+                  << (cell.printImmediately ? "1" : "2") << " threads=" << cell.threads
+                  << " max=" << cell.maxNumber << "\n";
+    }
+
+    // Speedup against the smallest thread count of the same scheme, mode and size
+    for (BenchCell &cell : cells) {
+        for (const BenchCell &ref : cells) {
+            if (ref.scheme == cell.scheme && ref.printImmediately == cell.printImmediately
+                && ref.maxNumber == cell.maxNumber && ref.threads == threadCounts.front()) {
+                cell.speedup = ref.medianMs / cell.medianMs;
+                cell.efficiency = cell.speedup * ref.threads / cell.threads;
+            }
+        }
+    }
+
+    std::cout << std::setfill(' ')
+              << std::setw(7) << "scheme" << std::setw(11) << "mode" << std::setw(9) << "threads"
+              << std::setw(14) << "max" << std::setw(13) << "median ms" << std::setw(11) << "p95 ms"
+              << std::setw(10) << "speedup" << std::setw(12) << "efficiency" << "\n"
+              << std::fixed;
+    for (const BenchCell &c : cells) {
+        std::cout << std::setw(7) << schemeName(c.scheme)
+                  << std::setw(11) << (c.printImmediately ? "immediate" : "after")
+                  << std::setw(9) << c.threads << std::setw(14) << c.maxNumber
+                  << std::setprecision(1) << std::setw(13) << c.medianMs << std::setw(11) << c.p95Ms
+                  << std::setprecision(2) << std::setw(9) << c.speedup << "x"
+                  << std::setw(11) << c.efficiency * 100 << "%\n";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+
+    std::ofstream csv(csvPath), json(jsonPath);
+    if (!csv || !json) {
+        std::cerr << "Could not write " << (!csv ? csvPath : jsonPath) << std::endl;
+        return 1;
+    }
+    writeBenchCsv(csv, cells, base.minNumber);
+    writeBenchJson(json, cells, base.minNumber);
+    std::cout << "\nWrote " << csvPath << " and " << jsonPath << "\n";
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// Baillie-PSW agreement check ('main verify').
+//
+// Compares isPrimeBailliePSW with trial division (isPrimeSingleThread) for
+// every n in [1..max] (default 10^8), spread over 'threads' workers. Larger
+// inputs are compared with the 7-base Miller-Rabin instead: base-2 strong
+// pseudoprimes, which are exactly what the Lucas half has to catch, and a
+// sample of random 63-bit numbers. Finally, Scheme K's prime counts are
+// checked against Scheme W's above 10^9 with several thread counts and, with
+// --top=true, the other range schemes against Scheme A just below 2^63.
+// ----------------------------------------------------------------------------
+int runVerify(const char* program, const std::vector<std::string> &args) {
+    std::vector<std::string> settings;
+    if (!parseFlags(args, settings)) {
+        std::cerr << "Usage: " << program << " verify [--max=100000000] [--threads=N] [--top=false]\n";
+        return 1;
+    }
+    long maxNumber = 100000000;
+    long numThreads = std::max(1L, static_cast<long>(std::thread::hardware_concurrency()));
+    bool checkTop = false;
+    for (const std::string &setting : settings) {
+        Config parsed;
+        if (setting.rfind("maxNumber=", 0) == 0 || setting.rfind("threads=", 0) == 0) {
+            if (applyConfigLine(setting, parsed) != CONFIG_APPLIED) return 1;
+            if (parsed.maxNumber > 0) maxNumber = parsed.maxNumber;
+            if (parsed.threads > 0) numThreads = parsed.threads;
+        } else if (setting.rfind("top=", 0) == 0) {
+            if (!parseBool("top", setting.substr(4), checkTop)) return 1;
+        } else {
+            std::cerr << "Unknown option: --" << setting.substr(0, setting.find('=')) << "\n";
+            return 1;
+        }
+    }
+
+    std::mutex mismatchMutex;
+    std::vector<long> mismatches;
+    std::vector<std::string> countMismatches;
+    auto disagree = [&](long n) {
+        std::lock_guard<std::mutex> lk(mismatchMutex);
+        mismatches.push_back(n);
+    };
+
+    // 1) Every n up to maxNumber against trial division
+    auto start = std::chrono::steady_clock::now();
+    WorkStealingScheduler scheduler(numThreads, 1, maxNumber, 1 << 16);
+    std::vector<long> primes(numThreads, 0);
+    std::vector<std::thread> threads;
+    for (long t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&, t] {
+            WorkRange range;
+            bool stolen;
+            while (scheduler.next(t, range, stolen)) {
+                for (long n = range.start; n <= range.end; ++n) {
+                    bool expected = isPrimeSingleThread(n);
+                    if (isPrimeBailliePSW(n) != expected) disagree(n);
+                    if (expected) ++primes[t];
+                }
+            }
+        });
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    long primeCount = 0;
+    for (long c : primes) primeCount += c;
+    std::cout << "[1.." << maxNumber << "] vs trial division: " << primeCount << " primes, "
+              << mismatches.size() << " disagreements ("
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start).count() << " ms)\n";
+
+    // 2) Base-2 strong pseudoprimes and primes near 2^63 against Miller-Rabin
+    static const long kLarge[] = {
+        3215031751L, 2152302898747L, 3474749660383L, 341550071728321L,
+        3825123056546413051L, 318665857834031151L, 7999252175582851L,
+        1000000000000000003L, 999999999999999989L, 9223372036854775783L,
+        9223372036854775807L, 4611686014132420609L   // (2^31 - 1)^2
+    };
+    size_t before = mismatches.size();
+    for (long n : kLarge) {
+        if (isPrimeBailliePSW(n) != isPrimeMontgomery(n)) disagree(n);
+    }
+    std::mt19937_64 rng(2024);
+    const long kRandom = 1000000;
+    for (long i = 0; i < kRandom; ++i) {
+        long n = static_cast<long>(rng() >> 1);
+        if (isPrimeBailliePSW(n) != isPrimeMontgomery(n)) disagree(n);
+    }
+    std::cout << "Pseudoprimes and " << kRandom << " random 63-bit numbers vs Miller-Rabin: "
+              << mismatches.size() - before << " disagreements\n";
+
+    // 3) Scheme K's bucket ring against Scheme W's counts above 10^9, where
+    //    the first multiples p^2 of the large primes lie far beyond the ring
+    auto countPrimes = [](Scheme scheme, long lo, long hi, long threads) {
+        g_countOnly = true;
+        g_primeCount = 0;
+        if (scheme == SCHEME_A) {
+            runSchemeA(lo, hi, threads, false);
+        } else if (scheme == SCHEME_B) {
+            runSchemeB(lo, hi, threads, false);
+        } else if (scheme == SCHEME_C) {
+            runSchemeC(lo, hi, threads, false);
+        } else if (scheme == SCHEME_S) {
+            runSchemeS(lo, hi, threads, false);
+        } else if (scheme == SCHEME_K) {
+            runSchemeK(lo, hi, threads, false);
+        } else {
+            runSchemeW(lo, hi, threads, false, "");
+        }
+        g_countOnly = false;
+        return g_primeCount;
+    };
+    static const long kWindows[][2] = {
+        { 1, 1200000000L }, { 1, 2000000000L }, { 999000000000L, 1000000000000L }
+    };
+    for (const auto &window : kWindows) {
+        long expected = countPrimes(SCHEME_W, window[0], window[1], numThreads);
+        for (long threads : { 1L, 3L, numThreads }) {
+            long count = countPrimes(SCHEME_K, window[0], window[1], threads);
+            if (count != expected) {
+                std::lock_guard<std::mutex> lk(mismatchMutex);
+                countMismatches.push_back("Scheme K on [" + std::to_string(window[0]) + ".." +
+                                          std::to_string(window[1]) + "] with " +
+                                          std::to_string(threads) + " threads: " +
+                                          std::to_string(count) + ", Scheme W: " +
+                                          std::to_string(expected));
+            }
+        }
+    }
+    std::cout << "Scheme K vs Scheme W counts above 10^9: " << countMismatches.size()
+              << " disagreements\n";
+
+    // 4) The sieves against Scheme A at the top of the range, where their
+    //    strides pass LONG_MAX. Slow: the base primes go up to 3 * 10^9.
+    //    Schemes B and C divide by every odd number up to sqrt(n), so they
+    //    get a window of 31 numbers holding a single prime.
+    auto checkAgainstA = [&](std::initializer_list<Scheme> schemes, const char* label,
+                             long lo, long hi) {
+        const long expected = countPrimes(SCHEME_A, lo, hi, 2);
+        size_t before = countMismatches.size();
+        for (Scheme scheme : schemes) {
+            long count = countPrimes(scheme, lo, hi, 2);
+            if (count != expected) {
+                countMismatches.push_back(std::string("Scheme ") + schemeName(scheme) + " on [" +
+                                          std::to_string(lo) + ".." + std::to_string(hi) +
+                                          "]: " + std::to_string(count) + ", Scheme A: " +
+                                          std::to_string(expected));
+            }
+        }
+        std::cout << label << " vs Scheme A on [" << lo << ".." << hi << "]: "
+                  << expected << " primes, " << countMismatches.size() - before << " disagreements\n";
+    };
+    if (checkTop) {
+        const long topHi = std::numeric_limits<long>::max();
+        checkAgainstA({ SCHEME_S, SCHEME_W, SCHEME_K }, "Schemes S, W and K", topHi - 5807, topHi);
+        checkAgainstA({ SCHEME_B, SCHEME_C }, "Schemes B and C", topHi - 30, topHi);
+    }
+
+    for (size_t i = 0; i < mismatches.size() && i < 10; ++i) {
+        std::cout << "  disagreement at " << mismatches[i] << "\n";
+    }
+    for (const std::string &mismatch : countMismatches) {
+        std::cout << "  " << mismatch << "\n";
+    }
+    const bool ok = mismatches.empty() && countMismatches.empty();
+    std::cout << (ok ? "OK\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    // 0) Help, then subcommands
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0], std::cout);
+            return 0;
+        }
+    }
+    if (argc >= 2 && std::string(argv[1]) == "decode") {
+        if (argc != 3) {
+            std::cerr << "Usage: " << argv[0] << " decode <prime file>\n";
+            return 1;
+        }
+        return runDecode(argv[2]);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        return runBench(argv[0], std::vector<std::string>(argv + 2, argv + argc));
+    }
+    if (argc >= 2 && std::string(argv[1]) == "verify") {
+        return runVerify(argv[0], std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    // 1) Read config: the file first, then the command-line flags over it
+    std::vector<std::string> settings;
+    if (!parseFlags(std::vector<std::string>(argv + 1, argv + argc), settings)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::string configPath = "config.txt", batchPath;
+    bool configRequired = false;
+    std::vector<std::string> overrides;
+    for (const std::string &setting : settings) {
+        if (setting.rfind("config=", 0) == 0) {
+            configPath = setting.substr(7);
+            configRequired = true;
+        } else if (setting.rfind("batch=", 0) == 0) {
+            batchPath = setting.substr(6);
+        } else {
+            overrides.push_back(setting);
+        }
+    }
+
+    Config config;
+    readConfig(configPath, config, configRequired);
+    switch (applySettings(overrides, config)) {
+    case CONFIG_APPLIED:
+        break;
+    case CONFIG_UNKNOWN_KEY:
+        printUsage(argv[0]);
+        return 1;
+    case CONFIG_BAD_VALUE:
+        return 1;
+    }
+    if (config.tscClock) {
+        g_useTscClock = g_tscClock.calibrate();
+        if (!g_useTscClock) {
+            std::cerr << "No invariant TSC available; using system_clock for timestamps.\n";
+        }
+    }
+    if (!batchPath.empty()) {
+        return runBatch(batchPath, config);
+    }
+
+    if (!validateConfig(config)) return 1;
+    const long numThreads = config.threads;
+    std::cout << "Config says: threads=" << numThreads;
+    if (config.minNumber > 1) std::cout << ", minNumber=" << config.minNumber;
+    std::cout << ", maxNumber=" << config.maxNumber << "\n\n";
+
+    // 2) Let user pick which scheme and print mode, unless the config did
+    Scheme scheme = config.scheme;
+    bool printImmediately = config.printImmediately;
+    bool countOnly = config.countOnly;
+    if (!config.schemeSet) {
+        int choice;
+        do {
+            std::cout << "Choose approach:\n";
+            for (int i = 0; i < kMenuSize; ++i) {
+                std::cout << "  " << (i + 1) << ") " << kMenu[i].label << "\n";
+            }
+            std::cout << "Enter choice (1-" << kMenuSize << "): ";
+            std::cin >> choice;
+
+            if (std::cin.fail() || choice < 1 || choice > kMenuSize) {
+                if (std::cin.eof()) {
+                    std::cerr << "\nNo choice made.\n";
+                    return 1;
+                }
+                std::cin.clear();
+                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                std::cerr << "Invalid choice. Please enter a number between 1 and " << kMenuSize << ".\n";
+                choice = 0;
+            }
+        } while (choice < 1 || choice > kMenuSize);
+
+        // The entry picks the scheme and how to print; mode=count from the
+        // config still applies and replaces the printing.
+        scheme = kMenu[choice - 1].scheme;
+        printImmediately = !countOnly && kMenu[choice - 1].printImmediately;
+    }
+
+    applyTuning(config);
+
+    // 3) Single-number query: no threads, no run banner
+    if (scheme == SCHEME_Q) {
+        long n = config.number;
+        if (!config.numberSet) {
+            std::cout << "Enter number to test: ";
+            std::cin >> n;
+            if (std::cin.fail()) {
+                std::cerr << "Invalid number.\n";
+                return 1;
+            }
+        }
+
+        bool useTrialDivision = g_forceTrialDivision || n < g_millerRabinCrossover;
+        auto queryStart = std::chrono::steady_clock::now();
+        bool prime = isPrime(n);
+        auto queryEnd = std::chrono::steady_clock::now();
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(queryEnd - queryStart).count();
+
+        std::cout << n << (prime ? " is prime" : " is not prime")
+                  << " (" << (useTrialDivision ? "trial division"
+                              : g_useBailliePSW ? "Baillie-PSW"
+                              : g_useMontgomery ? "Miller-Rabin, Montgomery" : "Miller-Rabin, int128")
+                  << ", " << micros << " us)\n";
+        return 0;
+    }
+
+    if (scheme == SCHEME_N) {
+        long n = config.number;
+        if (!config.numberSet) {
+            std::cout << "Enter n: ";
+            std::cin >> n;
+        }
+        if (std::cin.fail() || n < 1) {
+            std::cerr << "Invalid n.\n";
+            return 1;
+        }
+        if (n > kPrimeCountLongMax) {
+            std::cerr << "n is too large: there are only " << kPrimeCountLongMax
+                      << " primes below 2^63.\n";
+            return 1;
+        }
+
+        NthPrimeTimings timings;
+        long p = nthPrime(n, numThreads, timings);
+        std::cout << "Prime #" << n << " is " << p << "\n"
+                  << std::fixed << std::setprecision(1)
+                  << "  estimate li^-1(n) = " << timings.estimate << ": " << timings.estimateMs << " ms\n"
+                  << "  count    pi(" << timings.estimate << ") = " << timings.countAtEstimate
+                  << ": " << timings.countMs << " ms\n"
+                  << "  sieve    " << timings.windows << " window(s) between the estimate and p_n: "
+                  << timings.sieveMs << " ms\n";
+        return 0;
+    }
+
+    if (scheme == SCHEME_M) {
+        runMicrobenchmarks();
+        return 0;
+    }
+
+    JobResult result;
+    return runJob(config, scheme, printImmediately, countOnly, result) ? 0 : 1;
 }